@@ -4,21 +4,54 @@
 #define _BSD_SOURCE
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 /*** defines ***/
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 8
 #define KILO_QUIT_TIMES 3
+#define KILO_CACHE_BUDGET (64 * 1024 * 1024) 	//bytes of render & hl caches we keep before hidden buffers have to give theirs up
+#define KILO_FOLLOW_CHUNK (1024 * 1024) 		//bytes read at a time from a file we follow
+#define KILO_FOLLOW_MAX_CHUNKS 64 		//chunks read per event tick, so a fast writer can't starve the keyboard
+#define KILO_GZ_CHUNK (256 * 1024) 		//bytes inflated or read from a compressed file at a time
+#define KILO_LOAD_CHUNK (1024 * 1024) 		//bytes the loader thread reads at a time, each chunk becomes a batch of rows
+#define KILO_LOAD_BUDGET_MS 25 			//time the main loop spends appending loaded rows before it looks at the keyboard again
+#define KILO_GZ_SPAN (1024 * 1024) 		//uncompressed bytes between seek points of a compressed file
+#define KILO_GZ_WINSIZE 32768 			//the deflate window, a seek point needs a copy of it to restart inflating
+#define KILO_HL_MIN_CHUNK 2048 			//fewest rows worth handing to another thread when highlighting a whole file
+#define KILO_SYNTAX_DIR ".kilo/syntax" 		//under $HOME, where *.syntax definitions are read from unless $KILO_SYNTAX_DIR is set
+#define KILO_SYNTAX_CACHE ".kilo/syntax.cache" 	//under $HOME, the compiled definitions so startup doesn't parse them again
+#define KILO_SYNTAX_MAGIC 0x4b53594eu 		//"KSYN", first word of the cache, followed by the format version
+#define KILO_SYNTAX_VERSION 2
+#define KILO_SYNTAX_QUOTES 3 			//most quote characters a syntax can have
+#define KILO_WRAP_CHUNK 4096 			//rows laid out per job when a whole buffer is soft wrapped
+#define KILO_COL_BLOCK 64 			//bytes of chars between the checkpoints of a row's column index
+#define KILO_OUT_RING (256 * 1024) 		//initial size of the output ring, grows to fit the largest frame twice
+#define KILO_UNDO_BYTES (64 * 1024 * 1024) 	//text kept for undo per buffer, the oldest commands are forgotten past it
+#define KILO_FILTER_CHUNK 16384 		//rows matched per job when a filter view scans its source
+#define KILO_HEX_SNIFF 4096 			//bytes at the start of a file looked at on open, a NUL among them means it is binary
+#define KILO_HEX_WIDTH 16 			//bytes on a line of the hex view
 #define CTRL_KEY(k) ((k) & 0x1f)
 
 enum editorKey {
@@ -37,6 +70,12 @@ enum editorKey {
 	PAGE_DOWN 	,
 };
 
+enum rowColKey { 			//what editorRowSeek looks a character up by
+	COL_BY_CX 	= 0,
+	COL_BY_RX 	,
+	COL_BY_COL 	,
+};
+
 enum editorHighlight {
 	HL_NORMAL 	= 0,
 	HL_COMMENT 	,
@@ -50,6 +89,17 @@ enum editorHighlight {
 
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
+#define HL_SPAN_MAX ((1 << 24) - 1) 	//longest run one span can hold, longer runs take several spans
+
+//character classes, looked up for every byte of render by the highlighter
+#define CC_SEP (1<<0) 		//ends a number or keyword
+#define CC_DIGIT (1<<1)
+#define CC_QUOTE (1<<2) 	//opens a string, only when the syntax highlights strings
+#define CC_COMMENT (1<<3) 	//first byte of a comment start
+#define CC_KEYWORD (1<<4) 	//first byte of some keyword
+#define CC_NUMTAIL (1<<5) 	//continues a number that already started, like the '.' in 3.14
+#define CC_STRSTOP (1<<6) 	//a quote or the escape, the only bytes that matter inside a string
+#define CC_STOP (CC_SEP | CC_QUOTE | CC_COMMENT) 	//bytes the highlighter can't skip over in the middle of a word
 /*** data ***/
 struct editorSyntax {
 	char *filetype;
@@ -58,7 +108,33 @@ struct editorSyntax {
 	char *singleline_comment_start;	//contains the string that a singeline comment starts with
 	char *multiline_comment_start;
 	char *multiline_comment_end;
+	char *quotes; 			//characters that open & close a string
+	char *number_tail; 		//characters that continue a number once it started
 	int flags; 			//bit flags to determine whether we highlight numbers or strings for the filetype
+	//compiled tables, built once when the syntax is loaded & shared by every buffer using it
+	int nkeywords;
+	int *keyword_len; 		//length of each keyword, not counting the trailing '|'
+	unsigned char *keyword_hl; 	//HL_KEYWORD1 or HL_KEYWORD2 for each keyword
+	int *keyword_hash; 		//open addressing table of keyword indexes by hashed text, -1 is an empty slot
+	int hash_mask; 			//slots in keyword_hash - 1, the slot count is a power of two
+	int keyword_max; 		//length of the longest keyword, no longer word needs a lookup
+	int scs_len; 			//length of the singleline comment start
+	int mcs_len; 			//length of the multiline comment start
+	int mce_len; 			//length of the multiline comment end
+	unsigned char *cls; 		//CC_ bits for every byte value
+	int simd_words; 		//letters, digits, '_' and bytes >= 0x80 never stop a word, so they can be skipped 16 at a time
+};
+//a run of render characters sharing a highlight, 8 bytes no matter how long the run is
+struct hlSpan {
+	int start; 			//render index of the first character
+	unsigned int len : 24;
+	unsigned int hl : 8; 		//an editorHighlight other than HL_NORMAL
+};
+//a character boundary of a row, one every KILO_COL_BLOCK bytes makes up the column index
+struct rowCol {
+	int cx; 			//index in chars
+	int rx; 			//index in render
+	int col; 			//display column
 };
 //an Editor ROW, dynamically stores a line of text
 typedef struct erow {
@@ -66,30 +142,197 @@ typedef struct erow {
 	int size; 		//size of char string
 	int rsize; 		//size of render string
 	char *chars; 		//contains the raw file contents
-	char *render; 		//contains our render version that will be displayed
+	char *render; 		//contains our render version that will be displayed, points at chars when there's no tab to expand
 	int hl_open_comment;
-	unsigned char *hl; //indicates whether a character, in RENDER, is part of a string, comment, number, &c.
+	struct hlSpan *hl; 	//runs of RENDER that are part of a string, comment, number, &c. in order, gaps are HL_NORMAL
+	int nhl; 		//number of spans in hl
+	int hlcap; 		//spans allocated in hl
+	int plain; 		//render is ASCII without tabs, so byte index, render index & column are all the same
+	struct rowCol *cols; 	//column index of a row that isn't plain, built the first time it is needed
+	int vlines; 		//screen lines the row takes when soft wrapped at the buffer's wrap_width
+	int crlf; 		//flag, the line ended in \r\n in the file. the \r isn't in chars but the file offsets count it
 } erow;
-struct editorConfig { 				//global struct that will contain our editor state
+//a place in a compressed file we can restart inflating from, without going back to the start
+struct gzPoint {
+	off_t out; 		//offset in the uncompressed data
+	off_t in; 		//offset in the compressed file of the first byte that is not used up yet
+	int bits; 		//if not 0, the bits of the byte before 'in' that still belong to the stream
+	int line; 		//index of the first row that starts at or after 'out'
+	int midline; 		//flag, 'out' is in the middle of a line, restarting has to skip past its new-line
+	int winlen; 		//bytes in window
+	unsigned char *window; 	//the uncompressed data preceding 'out', back-references resolve against it
+};
+//the seek points of a compressed buffer, valid for as long as the rows match the file
+struct gzIndex {
+	int have; 		//points in list
+	int size; 		//points allocated in list
+	struct gzPoint *list;
+};
+//a Fenwick tree over one number per row, a prefix sum & the row it falls in both take O(log n)
+struct rowTree {
+	long long *sum; 	//1-based, entry i holds the total of rows (i - lowbit(i), i]
+	int n; 			//rows in the tree
+	int cap; 		//entries allocated in sum
+	int stale; 		//flag, rows were inserted or deleted & the tree has to be rebuilt before it is used
+};
+enum undoKind {
+	UNDO_TEXT 	= 0, 		//a row had other text
+	UNDO_INSERT 	, 		//a row was inserted
+	UNDO_DELETE 	, 		//a row was deleted
+};
+//one row change, undone by applying its inverse
+struct undoRec {
+	int kind; 		//an undoKind
+	int group; 		//records of one command share a group & are undone together
+	int idx; 		//the row
+	char *chars; 		//UNDO_TEXT & UNDO_DELETE: the text the row had, owned by the record
+	int size;
+	int cx, cy; 		//the cursor before the command
+};
+struct undoLog {
+	struct undoRec *rec; 	//oldest first
+	int n; 			//records in rec
+	int cap; 		//records allocated in rec
+	size_t bytes; 		//text held by the records, kept under KILO_UNDO_BYTES
+	int group; 		//group of the command being recorded
+	int typing; 		//flag, the last command typed a character & the next one on the same row joins it
+	int typing_cx; 		//where the cursor was left by that character
+};
+//an Editor BUFFER, one open file along with the cursor & scroll position within it
+typedef struct editorBuffer {
 	int cx,cy; 				//cursor x & y positions, 0,0 == top-left
 	int rx; 				//cursor x position in render
 	int row_off; 				//row offset
 	int col_off; 				//column offset
-	int screenrows; 			//count of rows on screen
-	int screencols; 			//count of columns on screen
 	int numrows; 				//the number of rows
+	int rowcap; 				//the number of rows allocated in row, grows by doubling so appends are cheap
 	erow *row; 				//array of rows
 	int dirty; 				//measure of how modified a file is. 0 = unadultered, >0 indictates # of changes
 	char* filename; 			//the name of the file
-	char statusmsg[80]; 			//the status message to display
+	struct editorSyntax *syntax; 		//pointer to the current syntax, shared with other buffers of the same filetype
+	size_t cache_bytes; 			//bytes held by the render & hl caches of the rows, these can be rebuilt from chars
+	unsigned long last_used; 		//value of E.tick when the buffer was last active, used to release the coldest caches first
+	off_t file_bytes; 			//how many bytes of the file have been read into (or saved from) the rows
+	int partial_line; 			//the last row came from a line without a trailing new-line, more data continues it
+	int follow; 				//flag, we are appending whatever is written to the end of the file
+	int follow_fd; 				//read-only fd of the followed file
+	int follow_wd; 				//inotify watch descriptor of the followed file
+	int follow_pending; 			//there was more to read than KILO_FOLLOW_MAX_CHUNKS, read it on the next tick
+	int compressed; 			//flag, the file is gzip compressed & is compressed again on save
+	struct gzIndex *gz; 			//seek points of the compressed file, NULL once the rows were edited
+	int evicted; 				//flag, some rows gave up their chars & have to be inflated again from gz
+	struct editorLoader *loader; 		//the thread still reading the file, NULL once every row is in
+	int load_percent; 			//how much of the file the loader had read at the last event tick
+	int follow_on_load; 			//flag, start following once the loader is done
+	int match_row; 				//row of the search hit, drawn over the syntax highlighting
+	int match_start; 			//render index of the search hit
+	int match_len; 				//length of the search hit, 0 when there is none
+	int wrap; 				//flag, long rows are soft wrapped instead of scrolled sideways
+	int wrap_off; 				//screen lines of row_off scrolled off the top when wrapped
+	int wrap_width; 			//columns the vlines of the rows were laid out for, 0 = not laid out
+	struct rowTree wrap_tree; 		//the vlines of the rows, maps rows to screen lines & back
+	struct rowTree offsets; 		//the bytes of the rows with their new-lines, maps rows to file offsets & back. built by the first go-to
+	int cur_y, cur_x; 			//where the cursor is on screen, worked out by editorScroll
+	struct undoLog undo; 			//edits made through the editor operations, newest last
+	unsigned long gen; 			//bumped whenever rows change other than by appending, filter views rescan when it moves
+	struct editorBuffer *source; 		//a filter view: the buffer its rows are borrowed from, chars belongs to that one
+	char *filter; 				//the pattern of a filter view as typed, /regex/ or literal. shown in place of a file name
+	int *line_map; 				//the source row each row of a filter view shows
+	unsigned long source_gen; 		//gen of the source when the view was scanned
+	int source_rows; 			//source rows the view has scanned, rows appended after them are scanned on their own
+	int resync; 				//flag, the source changed while the view was hidden & its rows were dropped. until the
+						//next scan cy holds the source line the cursor was on, -1 for none
+	int hex; 				//flag, the file is shown as a hex dump of map instead of the rows
+	const unsigned char *map; 		//the file mapped read-only, only the pages on screen are ever read. NULL if empty
+	size_t map_len;
+	long long hex_cur; 			//byte of the file the cursor is on in the hex view
+	long long hex_top; 			//hex line at the top of the screen
+} editorBuffer;
+struct editorPool { 				//worker threads shared by every full-file pass, started on first use
+	int nthreads; 				//workers besides the main thread, 0 on a single core
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t start; 			//signalled when a new job is posted
+	pthread_cond_t done; 			//signalled when the last busy worker leaves a job
+	void (*fn)(void *, int); 		//the job, called once for every item in [0, n)
+	void *arg;
+	int n; 					//items in the job
+	int next; 				//next item to hand out
+	int busy; 				//workers currently running items
+	unsigned long gen; 			//bumped for every job, workers sleep until it moves
+};
+
+struct editorOutput { 				//the terminal writer, frames are queued in a ring & written by their own thread
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t more; 			//signalled when bytes are queued
+	pthread_cond_t space; 			//signalled when bytes are written
+	char *ring;
+	size_t cap; 				//bytes in ring, a power of 2
+	unsigned long long head; 		//positions in the byte stream, ring index = position & (cap - 1)
+	unsigned long long tail; 		//everything before tail is written
+	unsigned long long taken; 		//the writer is writing [tail, taken)
+	long long queued; 			//where the newest frame starts while the writer hasn't taken any of it, else -1
+	unsigned long frames; 			//frames queued
+	unsigned long dropped; 			//frames replaced by a newer one before any of them was written
+	unsigned long long bytes; 		//bytes written to the terminal
+	double write_secs; 			//time spent in write(), bytes / write_secs is what the terminal takes
+};
+
+struct editorConfig { 				//global struct that will contain our editor state
+	int screenrows; 			//count of rows on screen
+	int screencols; 			//count of columns on screen
+	editorBuffer *buf; 			//the active buffer, everything on screen comes from here
+	editorBuffer **bufs; 			//array of every open buffer
+	int numbufs; 				//the number of open buffers
+	int curbuf; 				//index of the active buffer within bufs
+	unsigned long tick; 			//incremented every time we switch buffers
+	int inotify_fd; 			//shared by every followed file, -1 until the first follow
+	int wake_pipe[2]; 			//background threads write a byte here to wake the main loop out of poll()
+	struct saveJob *saves; 			//compressed saves still running in the background
+	struct editorPool pool; 		//threads for highlighting whole files
+	struct editorOutput out; 		//everything drawn goes through here
+	volatile sig_atomic_t resized; 		//set by the SIGWINCH handler, the main loop picks up the new size
+	unsigned long *screen_cur; 		//hash of every screen line as of the last frame queued, 0 = unknown
+	unsigned long *screen_base; 		//as of the frame before that, what stays on screen if the last one is dropped
+	unsigned long *screen_next; 		//filled in by the frame being drawn
+	int screen_lines; 			//lines in the screen hashes, the text rows & the two bars
+	struct editorSyntax **syntaxes; 	//every known syntax, in the order filenames are matched against them
+	int numsyntaxes;
+	pthread_mutex_t save_lock; 		//guards the done & err flags of the save jobs
+	char statusmsg[160]; 			//the status message to display, cut to the screen width when drawn
 	time_t statusmsg_time; 			//
-	struct editorSyntax *syntax; 		//pointer to the current syntax
 	struct termios original_termios; 	//the original state of the user's termio
 } E;
 /*** prototypes ***/
 void editorSetStatusMessage(const char* fmt, ...);
 void editorRefreshScreen();
 char *editorPrompt(char *prompt, void (*callback)(char *,int));
+void editorUpdateRow(editorBuffer *b, erow *row);
+void editorRowRender(erow *row);
+size_t editorRowCacheSize(erow *row);
+void editorRestoreText(editorBuffer *b);
+int editorWaitInput();
+int editorProcessEvents();
+void editorWake();
+void editorGzRestore(editorBuffer *b, int at);
+void editorGzFreeIndex(editorBuffer *b);
+void editorSaveGz(editorBuffer *b, char *buf, int len);
+int editorReapSavesOf(const char *filename, int wait);
+void editorLoad(editorBuffer *b, int fd, int compressed);
+void editorLoadFinish(editorBuffer *b);
+void editorFollow(editorBuffer *b, int on);
+void editorTrimCaches();
+void editorParallelFor(int n, void (*fn)(void *, int), void *arg);
+void editorIndexRow(editorBuffer *b, erow *row);
+void editorUndoFree(editorBuffer *b);
+int editorPrepareEdit(editorBuffer *b);
+int editorResize();
+void editorScreenReset();
+int editorFilterViews(editorBuffer *b);
+void editorFilterDetach(editorBuffer *src);
+int editorHexMap(editorBuffer *b, int fd);
+void editorHexUnmap(editorBuffer *b);
 
 /*** filetypes  ***/
 
@@ -106,10 +349,12 @@ struct editorSyntax HLDB[] = {
 		C_HL_EXTENSIONS,
 		C_HL_KEYWORDS,
 		"//", "/*", "*/",
-		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+		"\"'", ".",
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+		0, NULL, NULL, NULL, 0, 0, 0, 0, 0, NULL, 0 	//compiled by syntaxCompile()
 	},
 };
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0])) 	//built in, definitions from files come first & can replace them
 
 /*** terminal  ***/
 //prints error message & exits program
@@ -164,10 +409,14 @@ void enableRawMode() {
 }
 
 int editorReadKey() {
-	int nread;
+	int nread = 0;
 	char c;
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1){
-		if (nread == -1 && errno != EAGAIN) die("read");//if read == -1 it indicates a failure, on some systems it will return -1 & flag EAGAIN on timeout
+	while (nread != 1) {
+		if (editorWaitInput()) { 			//sleeps until there is a key, or a loader/inotify/save wakes us
+			nread = read(STDIN_FILENO, &c, 1);
+			if (nread == -1 && errno != EAGAIN && errno != EINTR) die("read");//if read == -1 it indicates a failure, on some systems it will return -1 & flag EAGAIN on timeout
+		}
+		if (nread != 1 && editorProcessEvents()) editorRefreshScreen(); 	//no key yet, catch up on anything that changed in the meantime
 	}
 	if (c == '\x1b') {
 		//if I create a char array for the sequence of escapes, we end up with w,a,s,d repeating their inputs infinitely until another character is pressed
@@ -248,6 +497,79 @@ int getWindowSize(int *rows, int *cols) {
 	//
 }
 
+/*** threads ***/
+//starts a helper thread with every signal blocked, so SIGWINCH is always handled by the main thread
+int editorThreadCreate(pthread_t *thread, void *(*fn)(void *), void *arg) {
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old); 	//the new thread inherits the mask
+	int r = pthread_create(thread, NULL, fn, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return r;
+}
+
+void *editorPoolThread(void *arg) {
+	struct editorPool *p = arg;
+	unsigned long seen = 0; 			//the last job this worker looked at
+	pthread_mutex_lock(&p->lock);
+	while (1) {
+		while (p->gen == seen) pthread_cond_wait(&p->start, &p->lock);
+		seen = p->gen;
+		p->busy++;
+		while (p->next < p->n) { 		//take items until the job runs dry
+			int j = p->next++;
+			void (*fn)(void *, int) = p->fn;
+			void *fnarg = p->arg;
+			pthread_mutex_unlock(&p->lock);
+			fn(fnarg, j);
+			pthread_mutex_lock(&p->lock);
+		}
+		if (--p->busy == 0) pthread_cond_signal(&p->done);
+	}
+	return NULL;
+}
+
+//starts a worker for every core but the one the main thread runs on
+void editorPoolInit() {
+	struct editorPool *p = &E.pool;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	p->nthreads = cores > 1 ? cores - 1 : 0;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->done, NULL);
+	p->threads = malloc(sizeof(pthread_t) * (p->nthreads + 1));
+	for (int j = 0; j < p->nthreads; j++) {
+		if (editorThreadCreate(&p->threads[j], editorPoolThread, p) != 0) { //run with the threads we got
+			p->nthreads = j;
+			break;
+		}
+	}
+}
+
+//calls fn(arg, j) for every j in [0, n) across the pool, the main thread takes items too. returns when all are done
+void editorParallelFor(int n, void (*fn)(void *, int), void *arg) {
+	struct editorPool *p = &E.pool;
+	if (n <= 1 || p->nthreads == 0) { 		//not worth waking anyone
+		for (int j = 0; j < n; j++) fn(arg, j);
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	p->fn = fn;
+	p->arg = arg;
+	p->n = n;
+	p->next = 0;
+	p->gen++;
+	pthread_cond_broadcast(&p->start);
+	while (p->next < p->n) {
+		int j = p->next++;
+		pthread_mutex_unlock(&p->lock);
+		fn(arg, j);
+		pthread_mutex_lock(&p->lock);
+	}
+	while (p->busy > 0) pthread_cond_wait(&p->done, &p->lock); //the last items may still be running elsewhere
+	pthread_mutex_unlock(&p->lock);
+}
+
 /*** syntax highlighting ***/
 
 int is_separator(int c) {
@@ -256,43 +578,222 @@ int is_separator(int c) {
 		|| strchr(",.()+-/*=~%<>[];",c) != NULL;
 }
 
-void editorUpdateSyntax(erow *row) {
-	row->hl = realloc(row->hl, row->rsize); 	//because the highlights refer to every character in render, they are the same length
-	memset(row->hl, HL_NORMAL, row->rsize); 	//set all the values to be of NORMAL highlight
+//is the byte one that the vector loop in hlSkipWord treats as part of a word
+int is_simd_word(int c) {
+	return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+unsigned int syntaxHash(const char *p, int len) { 	//FNV-1a
+	unsigned int h = 2166136261u;
+	for (int j = 0; j < len; j++) h = (h ^ (unsigned char)p[j]) * 16777619u;
+	return h;
+}
 
-	if (E.syntax == NULL) return; 			//if no syntax highlighting is set, exit
+//builds every table of a syntax but the keyword hash from its definition. cheap, so the cache doesn't hold these &
+//nothing the highlighter relies on to stop at the end of a row can come from a damaged file
+void syntaxCompileTables(struct editorSyntax *s) {
+	int n = 0;
+	while (s->keywords[n]) n++;
+	s->nkeywords = n;
+	s->keyword_len = malloc(sizeof(int) * (n + 1));
+	s->keyword_hl = malloc(n + 1);
+	s->keyword_max = 0;
+	for (int j = 0; j < n; j++) {
+		int klen = strlen(s->keywords[j]);
+		int kw2 = klen > 0 && s->keywords[j][klen-1] == '|'; 	//secondary keywords end with a pipe
+		s->keyword_len[j] = kw2 ? klen - 1 : klen;
+		s->keyword_hl[j] = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+		if (s->keyword_len[j] > s->keyword_max) s->keyword_max = s->keyword_len[j];
+	}
+	s->scs_len = s->singleline_comment_start ? strlen(s->singleline_comment_start) : 0;
+	s->mcs_len = s->multiline_comment_start ? strlen(s->multiline_comment_start) : 0;
+	s->mce_len = s->multiline_comment_end ? strlen(s->multiline_comment_end) : 0;
 
-	char **keywords = E.syntax->keywords; 		//the array of keywords
-	
-	char *scs = E.syntax->singleline_comment_start;	//the singleline comment start symbol
-	char *mcs = E.syntax->multiline_comment_start; 	//the mlc start symbol
-	char *mce = E.syntax->multiline_comment_end; 	//the mlc end symbol
+	s->cls = calloc(256, 1);
+	for (int c = 0; c < 256; c++) {
+		if (is_separator(c)) s->cls[c] |= CC_SEP;
+		if (isdigit(c)) s->cls[c] |= CC_DIGIT;
+	}
+	if ((s->flags & HL_HIGHLIGHT_STRINGS) && s->quotes) {
+		for (int j = 0; s->quotes[j]; j++) s->cls[(unsigned char)s->quotes[j]] |= CC_QUOTE | CC_STRSTOP;
+		s->cls['\\'] |= CC_STRSTOP;
+	}
+	for (int j = 0; s->number_tail && s->number_tail[j]; j++)
+		s->cls[(unsigned char)s->number_tail[j]] |= CC_NUMTAIL;
+	if (s->scs_len) s->cls[(unsigned char)s->singleline_comment_start[0]] |= CC_COMMENT;
+	if (s->mcs_len && s->mce_len) s->cls[(unsigned char)s->multiline_comment_start[0]] |= CC_COMMENT;
+	for (int j = 0; j < n; j++)
+		s->cls[(unsigned char)s->keywords[j][0]] |= CC_KEYWORD;
+	s->simd_words = 1;
+	for (int c = 0; c < 256; c++)
+		if (is_simd_word(c) && (s->cls[c] & CC_STOP)) s->simd_words = 0; 	//a comment that starts with a letter, say
+}
+
+//builds the lookup tables of a syntax from its definition, once when it is loaded
+void syntaxCompile(struct editorSyntax *s) {
+	syntaxCompileTables(s);
+	int n = s->nkeywords;
+	int slots = 8;
+	while (slots < n * 2) slots *= 2; 			//at most half full, so probe chains stay short
+	s->hash_mask = slots - 1;
+	s->keyword_hash = malloc(sizeof(int) * slots);
+	for (int j = 0; j < slots; j++) s->keyword_hash[j] = -1;
+	for (int j = 0; j < n; j++) {
+		if (s->keyword_len[j] == 0) continue;
+		unsigned int h = syntaxHash(s->keywords[j], s->keyword_len[j]) & s->hash_mask;
+		int dup = 0;
+		while (s->keyword_hash[h] != -1 && !dup) {
+			int k = s->keyword_hash[h];
+			dup = (s->keyword_len[k] == s->keyword_len[j] && !memcmp(s->keywords[k], s->keywords[j], s->keyword_len[j]));
+			h = (h + 1) & s->hash_mask;
+		}
+		if (!dup) s->keyword_hash[h] = j; 			//the first definition of a word wins
+	}
+}
+
+//returns the index of the keyword p[0..len) is, or -1
+int syntaxFindKeyword(struct editorSyntax *s, const char *p, int len) {
+	unsigned int h = syntaxHash(p, len) & s->hash_mask;
+	while (s->keyword_hash[h] != -1) {
+		int k = s->keyword_hash[h];
+		if (s->keyword_len[k] == len && !memcmp(s->keywords[k], p, len)) return k;
+		h = (h + 1) & s->hash_mask;
+	}
+	return -1;
+}
+
+//returns the index of the first byte at or after i that can't be skipped in the middle of a word
+int hlSkipWord(struct editorSyntax *syntax, const char *p, int i, int len) {
+#ifdef __SSE2__
+	if (syntax->simd_words) { 			//jump over runs of plain letters & digits, the table finishes the job
+		const __m128i lower_a = _mm_set1_epi8('a' - 1), lower_z = _mm_set1_epi8('z' + 1);
+		const __m128i digit_0 = _mm_set1_epi8('0' - 1), digit_9 = _mm_set1_epi8('9' + 1);
+		const __m128i case_bit = _mm_set1_epi8(0x20), under = _mm_set1_epi8('_');
+		while (i + 16 <= len) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+			__m128i folded = _mm_or_si128(v, case_bit); 	//'A'-'Z' become 'a'-'z'
+			__m128i word = _mm_and_si128(_mm_cmpgt_epi8(folded, lower_a), _mm_cmplt_epi8(folded, lower_z));
+			word = _mm_or_si128(word, _mm_and_si128(_mm_cmpgt_epi8(v, digit_0), _mm_cmplt_epi8(v, digit_9)));
+			word = _mm_or_si128(word, _mm_cmpeq_epi8(v, under));
+			word = _mm_or_si128(word, _mm_cmplt_epi8(v, _mm_setzero_si128())); 	//signed, so bytes >= 0x80
+			if (_mm_movemask_epi8(word) != 0xFFFF) break;
+			i += 16;
+		}
+	}
+#endif
+	while (i < len && !(syntax->cls[(unsigned char)p[i]] & CC_STOP)) i++;
+	return i;
+}
+
+//returns the index of the first quote or backslash at or after i, the only bytes that matter inside a string
+int hlSkipString(struct editorSyntax *syntax, const char *p, int i, int len) {
+#ifdef __SSE2__
+	__m128i stop[KILO_SYNTAX_QUOTES + 1]; 		//the escape & the quotes
+	int nstop = 0;
+	stop[nstop++] = _mm_set1_epi8('\\');
+	for (int j = 0; syntax->quotes[j]; j++) stop[nstop++] = _mm_set1_epi8(syntax->quotes[j]);
+	while (i + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i hit = _mm_cmpeq_epi8(v, stop[0]);
+		for (int j = 1; j < nstop; j++) hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, stop[j]));
+		if (_mm_movemask_epi8(hit) != 0) break;
+		i += 16;
+	}
+#endif
+	while (i < len && !(syntax->cls[(unsigned char)p[i]] & CC_STRSTOP)) i++;
+	return i;
+}
+
+//marks render[start, start+len) with a highlight, spans come in order so a run touching the last span of the same kind just extends it
+void hlEmit(erow *row, int start, int len, int hl) {
+	if (row->nhl > 0) {
+		struct hlSpan *last = &row->hl[row->nhl - 1];
+		int last_end = last->start + last->len;
+		if ((int)last->hl == hl && last_end >= start) {
+			int end = start + len;
+			if (end <= last_end) return;
+			if (end - last->start <= HL_SPAN_MAX) {
+				last->len = end - last->start;
+				return;
+			}
+			start = last_end; 			//too long for one span, the rest goes in new ones
+			len = end - last_end;
+		}
+	}
+	while (len > 0) {
+		if (row->nhl == row->hlcap) {
+			row->hlcap = row->hlcap ? row->hlcap * 2 : 4;
+			row->hl = realloc(row->hl, sizeof(struct hlSpan) * row->hlcap);
+		}
+		struct hlSpan *sp = &row->hl[row->nhl++];
+		sp->start = start;
+		sp->len = len < HL_SPAN_MAX ? len : HL_SPAN_MAX;
+		sp->hl = hl;
+		start += sp->len;
+		len -= sp->len;
+	}
+}
+
+//the highlight of render[i], where i is the last character emitted
+int hlLast(erow *row, int i) {
+	if (row->nhl == 0) return HL_NORMAL;
+	struct hlSpan *last = &row->hl[row->nhl - 1];
+	return (last->start + (int)last->len > i) ? (int)last->hl : HL_NORMAL;
+}
+
+//highlights one row, starting inside a multi-line comment or not. returns whether the row ends inside one
+//touches nothing but the row, so threads can highlight different rows at the same time
+int editorHighlightRow(struct editorSyntax *syntax, erow *row, int in_comment) {
+	row->nhl = 0; 					//no spans, so everything is NORMAL
 
-	int scs_len = scs ? strlen(scs) : 0; 		//length of the single-line comment marker
-	int mcs_len = mcs ? strlen(mcs) : 0; 		//len of multi-line comment starter
-	int mce_len = mce ? strlen(mce) : 0; 		//len of mlc end
+	if (syntax == NULL) { 				//if no syntax highlighting is set, exit
+		row->hl_open_comment = 0;
+		return 0;
+	}
+
+	char *scs = syntax->singleline_comment_start;	//the singleline comment start symbol
+	char *mcs = syntax->multiline_comment_start; 	//the mlc start symbol
+	char *mce = syntax->multiline_comment_end; 	//the mlc end symbol
+
+	int scs_len = syntax->scs_len; 		//length of the single-line comment marker
+	int mcs_len = syntax->mcs_len; 		//len of multi-line comment starter
+	int mce_len = syntax->mce_len; 		//len of mlc end
+
+	unsigned char *cls = syntax->cls; 		//class bits of each byte value
 
 	int prev_sep = 1; 				//so that numbers at the beginning of the line are highlighted
 	int in_string = 0; 				//keep track if we are in a string or not. stores the value of a double/single-quote depending on how the string was declared
-	int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment); //keeps track if we are in a multi-line comment
 
 	int i=0;
 	while (i < row->rsize) { 			//while the index is less than the length of render
 		char c = row->render[i]; 		//the character at index i 
-		unsigned char prev_hl = (i>0) ? row->hl[i-1] : HL_NORMAL;
+		unsigned char cc = cls[(unsigned char)c]; 	//the classes of c
+		int prev_hl = (i>0) ? hlLast(row, i-1) : HL_NORMAL;
 
-		if (scs_len && !in_string && !in_comment) {
+		if (!in_string && !in_comment && !prev_sep && prev_hl != HL_NUMBER && !(cc & CC_STOP)) {
+			i = hlSkipWord(syntax, row->render, i, row->rsize); 	//the rest of a word stays NORMAL & can't start anything
+			continue;
+		}
+
+		if (scs_len && !in_string && !in_comment && (cc & CC_COMMENT)) {
 			if (!strncmp(&row->render[i],scs,scs_len)) {
-				memset(&row->hl[i],HL_COMMENT, row->rsize-i);
+				hlEmit(row, i, row->rsize-i, HL_COMMENT);
 				break;
 			}
 		}
 
 		if (mcs_len && mce_len && !in_string) { 		//if mcs_len & mce_len are not null, and we are not in a string
 			if (in_comment) { 				//if we are already in the comment
-				row->hl[i] = HL_MLCOMMENT;
+				if (c != mce[0]) { 				//jump to the next byte that could end the comment
+					char *end = memchr(&row->render[i], mce[0], row->rsize - i);
+					int j = end ? end - row->render : row->rsize;
+					hlEmit(row, i, j - i, HL_MLCOMMENT);
+					i = j;
+					continue;
+				}
+				hlEmit(row, i, 1, HL_MLCOMMENT);
 				if (!strncmp(&row->render[i], mce, mce_len)) { 	//if the current index is the end of the multi-line comment
-					memset(&row->hl[i], HL_MLCOMMENT, mce_len); 	//highlight as a comment
+					hlEmit(row, i, mce_len, HL_MLCOMMENT); 	//highlight as a comment
 					i += mce_len; 				//increment index
 					in_comment = 0; 			//exit the comment
 					prev_sep = 1; 				//mark as a separator
@@ -302,19 +803,26 @@ void editorUpdateSyntax(erow *row) {
 					continue; 				//skip
 				}
 			}
-			else if (!strncmp(&row->render[i], mcs, mcs_len)) { 	//if the current index is the beginning of the comment
-				memset(&row->hl[i], HL_MLCOMMENT, mcs_len); 	//highlight the symbol
+			else if ((cc & CC_COMMENT) && !strncmp(&row->render[i], mcs, mcs_len)) { 	//if the current index is the beginning of the comment
+				hlEmit(row, i, mcs_len, HL_MLCOMMENT); 	//highlight the symbol
 				i += mcs_len; 					//increment the index
 				in_comment = 1; 				//flag that we are in a comment
 				continue; 					//skip
 			}
 		}
 
-		if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) { 	//highlight strings enabled
+		if (syntax->flags & HL_HIGHLIGHT_STRINGS) { 	//highlight strings enabled
 			if (in_string) { 				//if we are in a string
-				row->hl[i] = HL_STRING; 		//highlight as string
+				if (!(cc & CC_STRSTOP)) { 		//nothing but quotes & escapes matter in here
+					int j = hlSkipString(syntax, row->render, i, row->rsize);
+					hlEmit(row, i, j - i, HL_STRING);
+					i = j;
+					prev_sep = 1;
+					continue;
+				}
+				hlEmit(row, i, 1, HL_STRING); 		//highlight as string
 				if(c == '\\' && i + 1 < row->rsize) {
-					row->hl[i+1] = HL_STRING;
+					hlEmit(row, i+1, 1, HL_STRING);
 					i += 2;
 					continue;
 				}
@@ -323,18 +831,18 @@ void editorUpdateSyntax(erow *row) {
 				prev_sep = 1; 				//consider the final quote a separator
 				continue; 				//skip
 			} else { 					//if we are NOT in a string
-				if (c == '"' || c == '\'') { 		//see if the character is a quote
+				if (cc & CC_QUOTE) { 			//see if the character is a quote
 					in_string = c; 			//set the in_string to the quote's value
-					row->hl[i] = HL_STRING; 	//highliht as string
+					hlEmit(row, i, 1, HL_STRING); 	//highliht as string
 					i++; 				//increment
 					continue; 			//skip
 				}
 			}
 		}
-		if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) { 	//if number highlighting is enabled
-			if ((isdigit(c) &&  (prev_sep || prev_hl == HL_NUMBER)) //if the character is a digit and (the previous char was a SEPARATOR or highlighted as a NUMBER)
-				|| (c == '.' && prev_hl == HL_NUMBER)) { 	//if the character is a decimal, and previous value is highlighted as a number
-				row->hl[i] = HL_NUMBER; 	//set the highlight to a number
+		if (syntax->flags & HL_HIGHLIGHT_NUMBERS) { 	//if number highlighting is enabled
+			if (((cc & CC_DIGIT) &&  (prev_sep || prev_hl == HL_NUMBER)) //if the character is a digit and (the previous char was a SEPARATOR or highlighted as a NUMBER)
+				|| ((cc & CC_NUMTAIL) && prev_hl == HL_NUMBER)) { 	//if the character can continue a number, like a decimal point, and previous value is highlighted as a number
+				hlEmit(row, i, 1, HL_NUMBER); 	//set the highlight to a number
 				i++; 				//increase index
 				prev_sep = 0; 			//set prev_sep flag to 0, since this was a number
 				continue;
@@ -342,30 +850,52 @@ void editorUpdateSyntax(erow *row) {
 		}
 
 		if (prev_sep) { 							//keyword must be preceded by a separator
-			int j; 								//iterator
-			for (j = 0; keywords[j]; j++) { 				//FOR-EACH keyword
-				int klen = strlen(keywords[j]); 			//the LENGTH of the current keyword
-				int kw2 = keywords[j][klen-1] == '|'; 			//FLAG, if the keyword is a secondary keyword (ends with a pipe->|) 
-				if (kw2) klen--; 					//don't include the pipe
-				if (!strncmp(&row->render[i], keywords[j], klen) &&  	//IF there is a keyword at the current index
-						is_separator(row->render[i + klen])) { 	//AND if there is a separator following the keyword
-					memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen); 	//highlight the row
+			int found = 0; 							//whether a keyword starts here
+			if (cc & CC_KEYWORD) { 						//some keyword starts with c
+				int klen = 0; 						//a keyword has to run up to a separator, render ends in '\0' which is one
+				while (klen <= syntax->keyword_max && !(cls[(unsigned char)row->render[i + klen]] & CC_SEP)) klen++;
+				int j = (klen <= syntax->keyword_max) ? syntaxFindKeyword(syntax, &row->render[i], klen) : -1;
+				if (j >= 0) { 						//IF the word at the current index is a keyword
+					hlEmit(row, i, klen, syntax->keyword_hl[j]); 	//highlight the row
 					i += klen; 					//increment the index
-					break; 						//break
+					found = 1;
 				}
 			}
-			if (keywords[j] == NULL) { 			//if there are no keywords left
+			if (!found) { 					//if there are no keywords left
 				prev_sep = 0; 				//set sep to 0
 				continue; 				//skip
 			}
 		}
-		prev_sep = is_separator(c); 		//if the character is a separator, set the prev_sep flag
+		prev_sep = (cc & CC_SEP) != 0; 		//if the character is a separator, set the prev_sep flag
 		i++; 					//increment index
 	}
-	int changed = (row->hl_open_comment != in_comment); //if the comment highlight of a row is going to change
 	row->hl_open_comment = in_comment; 		//set highlight to whatever the comment status is
-	if (changed && row->idx + 1 < E.numrows) { 	//if the highlight did change, and we're not at the end of the file
-		editorUpdateSyntax(&E.row[row->idx+1]); 	//update the next row's syntax
+	return in_comment;
+}
+
+//highlights a row of a buffer, keeping the cache accounting in step with the spans it allocates
+int editorRehighlightRow(editorBuffer *b, erow *row, int in_comment) {
+	b->cache_bytes -= editorRowCacheSize(row);
+	in_comment = editorHighlightRow(b->syntax, row, in_comment);
+	b->cache_bytes += editorRowCacheSize(row);
+	return in_comment;
+}
+
+void editorUpdateSyntax(editorBuffer *b, erow *row) {
+	if (row->render == NULL) { 			//the caches were released, rebuilding the row highlights it again
+		editorUpdateRow(b, row);
+		return;
+	}
+	while (1) {
+		int was_open = row->hl_open_comment;
+		int in_comment = (row->idx > 0 && b->row[row->idx - 1].hl_open_comment); //keeps track if we are in a multi-line comment
+		editorRehighlightRow(b, row, in_comment);
+		if (row->hl_open_comment == was_open || row->idx + 1 >= b->numrows) break; //the rows below only change if this row's comment state did
+		row = &b->row[row->idx + 1]; 			//update the next row's syntax
+		if (row->render == NULL) { 			//released rows get rebuilt, which highlights and carries on from there
+			editorUpdateRow(b, row);
+			return;
+		}
 	}
 }
 
@@ -382,327 +912,2682 @@ int editorSyntaxToColor(int hl) {
 	}
 }
 
-void editorSelectSyntaxHighlight() {
-	E.syntax = NULL;
-	if (E.filename == NULL) return;
+//a slice of a full-file highlighting pass, one thread highlights it from the comment state the pre-scan says it starts in
+struct hlChunk {
+	int from, to; 					//rows [from, to)
+	int entry; 					//the comment state at from, as worked out by the pre-scan
+	int exit; 					//the comment state at the end, if entry was right
+	int scan_exit[2]; 				//the state the pre-scan ends in, starting outside & inside a comment
+	size_t grown; 					//cache bytes the rows grew by, spans are never shrunk so it can't go down
+};
 
-	char *ext = strchr(E.filename, '.');
-	for (unsigned int j = 0; j < HLDB_ENTRIES; j++) { 		//loop through each highlight DB entry
-		struct editorSyntax *s = &HLDB[j];
-		unsigned int i = 0;
-		while (s->filematch[i]) { 				//loop through each HLDB's filematch entries
-			int is_ext = (s->filematch[i][0] == '.');
-			if ((is_ext && ext && !strcmp(ext, s->filematch[i]))
-					|| (!is_ext && strstr(E.filename, s->filematch[i]))) {
-				E.syntax = s;
-				int filerow;
-				for(filerow=0; filerow<E.numrows;filerow++){
-					editorUpdateSyntax(&E.row[filerow]);
-				}
-				return;
-			}
+struct hlJob {
+	struct editorSyntax *syntax;
+	erow *row;
+	struct hlChunk *chunks;
+	unsigned char *open; 				//pre-scan: the state each row ends in when its chunk starts outside a comment
+};
+
+//follows only what opens & closes multi-line comments through a row: strings & single-line comments hide the markers.
+//a lot less work than highlighting, good enough to tell where a chunk starts
+int hlScanComments(struct editorSyntax *syntax, const char *p, int len, int in_comment) {
+	unsigned char *cls = syntax->cls;
+	int in_string = 0;
+	int i = 0;
+	while (i < len) {
+		if (in_comment) { 				//nothing but the end marker matters
+			char *end = memmem(&p[i], len - i, syntax->multiline_comment_end, syntax->mce_len);
+			if (end == NULL) return 1;
+			i = end - p + syntax->mce_len;
+			in_comment = 0;
+			continue;
+		}
+		unsigned char cc = cls[(unsigned char)p[i]];
+		if (in_string) {
+			if (p[i] == '\\') i++;
+			else if (p[i] == in_string) in_string = 0;
 			i++;
+			continue;
+		}
+		if (cc & CC_COMMENT) {
+			if (syntax->scs_len && !strncmp(&p[i], syntax->singleline_comment_start, syntax->scs_len)) return 0;
+			if (!strncmp(&p[i], syntax->multiline_comment_start, syntax->mcs_len)) {
+				i += syntax->mcs_len;
+				in_comment = 1;
+				continue;
+			}
 		}
+		if (cc & CC_QUOTE) in_string = p[i]; 	//only set when the syntax highlights strings
+		i++;
 	}
+	return in_comment;
 }
 
-/*** row operations ***/
-int editorRowCxtoRx(erow *row, int cx) { 	//converts a character index into a render index
-	int rx = 0; 				//the row index
-	int j; 					//iterator 
-	for (j = 0; j < cx; j++) { 		//for each character in the character string
-		if (row->chars[j] == '\t') 	//if we come across a tab (the only thing rendered differently by our editor)
-			rx+=(KILO_TAB_STOP-1) - (rx % KILO_TAB_STOP); //add characters until we hit the TAB STOP
-		rx++; 				//increment rx
+//pre-scans a chunk starting outside a comment, then inside one until the two agree on a row
+void editorScanChunk(void *arg, int k) {
+	struct hlJob *job = arg;
+	struct hlChunk *c = &job->chunks[k];
+	unsigned char *open = job->open - job->chunks[0].from; 	//indexed by row
+	int in_comment = 0;
+	for (int j = c->from; j < c->to; j++) {
+		in_comment = hlScanComments(job->syntax, job->row[j].chars, job->row[j].size, in_comment);
+		open[j] = in_comment;
+	}
+	c->scan_exit[0] = in_comment;
+	in_comment = 1;
+	for (int j = c->from; j < c->to; j++) {
+		in_comment = hlScanComments(job->syntax, job->row[j].chars, job->row[j].size, in_comment);
+		if (in_comment == open[j]) { 		//the same from here on
+			in_comment = c->scan_exit[0];
+			break;
+		}
 	}
-	return rx;
+	c->scan_exit[1] = in_comment;
 }
 
-int editorRowRxtoCx(erow *row, int rx) {
-	int cur_rx = 0; 			//our internal rx value
-	int cx; 				//the character index we will return later
-	for (cx = 0; cx < row->size; cx++) { 	//from character index 0 to the length of chars
-		if (row->chars[cx] == '\t') 	//if character is a TAB
-			cur_rx+=(KILO_TAB_STOP-1) - (cur_rx % KILO_TAB_STOP); //do the tab_stop math & increment cur_rx
-		cur_rx++; 			//increment cur_rx
-		if (cur_rx > rx) return cx; 	//if the current render index is greater than the rx argument, return CX
+void editorHighlightChunk(void *arg, int k) {
+	struct hlJob *job = arg;
+	struct hlChunk *c = &job->chunks[k];
+	int in_comment = c->entry;
+	for (int j = c->from; j < c->to; j++) {
+		erow *row = &job->row[j];
+		size_t before = editorRowCacheSize(row);
+		if (row->render == NULL) editorRowRender(row);
+		in_comment = editorHighlightRow(job->syntax, row, in_comment);
+		c->grown += editorRowCacheSize(row) - before;
 	}
-	return cx; 				//return the character index, I believe this just the end of the row
+	c->exit = in_comment;
 }
 
-void editorUpdateRow(erow *row) {
-	int tabs = 0; 					//total tabs found in row
-	int j; 						//iteration variable
-	for (j = 0; j < row->size; j++) 		//for-each character in the row
-		if (row->chars[j] == '\t') tabs++; 	//if character = tab, tab++
-	free(row->render); 				//free the render string
-	row->render = malloc(row->size + tabs*(KILO_TAB_STOP-1) + 1); 	//malloc the render string with extra-space allocated for spaces, TAB_STOP-1 because \t' =1
+//highlights rows [from, to) on every core. a pre-scan of the comment markers, also on every core, works out the state
+//each chunk starts in. the chunks are then walked in order & where the pre-scan was wrong (it doesn't know about
+//markers in the middle of words) the rows are highlighted again until they agree
+void editorHighlightRows(editorBuffer *b, int from, int to) {
+	if (from >= to) return;
+	editorRestoreText(b); 					//evicted rows have no chars to highlight
+	int was_open = b->row[to - 1].hl_open_comment;
+	int n = to - from;
+	int nchunks = (E.pool.nthreads + 1) * 4; 		//a few chunks per thread keeps them busy when rows differ in length
+	if (nchunks > n / KILO_HL_MIN_CHUNK) nchunks = n / KILO_HL_MIN_CHUNK;
+	if (nchunks < 1) nchunks = 1;
 
-	int idx = 0; 					//contains the number of letters copied into row->render
-	for (j = 0; j < row->size; j++) {
-		if (row->chars[j] == '\t') {
-			row->render[idx++] = ' ';
-			while (idx % 8 	!= 0)
-				row->render[idx++] = ' ';
+	struct hlChunk *chunks = calloc(nchunks, sizeof(struct hlChunk));
+	for (int k = 0; k < nchunks; k++) {
+		chunks[k].from = from + (long long)n * k / nchunks;
+		chunks[k].to = from + (long long)n * (k + 1) / nchunks;
+	}
+	chunks[0].entry = (from > 0 && b->row[from - 1].hl_open_comment); //the first chunk knows where it starts
+	struct hlJob job = { b->syntax, b->row, chunks, NULL };
+	struct editorSyntax *s = b->syntax;
+	if (nchunks > 1 && s && s->mcs_len && s->mce_len) { 	//without multi-line comments every chunk starts outside one
+		job.open = malloc(n);
+		editorParallelFor(nchunks, editorScanChunk, &job);
+		for (int k = 1; k < nchunks; k++)
+			chunks[k].entry = chunks[k - 1].scan_exit[chunks[k - 1].entry];
+		free(job.open);
+	}
+	editorParallelFor(nchunks, editorHighlightChunk, &job);
+
+	int in_comment = chunks[0].exit;
+	for (int k = 0; k < nchunks; k++) {
+		b->cache_bytes += chunks[k].grown;
+		if (k == 0) continue;
+		if (chunks[k].entry == in_comment) { 		//the pre-scan was right, the chunk is done
+			in_comment = chunks[k].exit;
+			continue;
 		}
-		else {
-			row->render[idx++] = row->chars[j];
+		int j;
+		for (j = chunks[k].from; j < chunks[k].to; j++) {
+			int guessed = b->row[j].hl_open_comment; 	//the state the row ended in from the wrong entry
+			in_comment = editorRehighlightRow(b, &b->row[j], in_comment);
+			if (in_comment == guessed) break; 		//from here on the rows are the same either way
 		}
+		if (j < chunks[k].to) in_comment = chunks[k].exit;
 	}
-	row->render[idx] = '\0';
-	row->rsize = idx;
-
-	editorUpdateSyntax(row);
+	free(chunks);
+	if (in_comment != was_open && to < b->numrows) editorUpdateSyntax(b, &b->row[to]); //the rows below start differently now
 }
 
-void editorInsertRow(int at, char *s, size_t len) {
-	if (at < 0 || at > E.numrows) return;
-	E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1)); //reallocate the array
-	memmove(&E.row[at+1], &E.row[at], sizeof(erow) * (E.numrows - at));
-	for (int j = at + 1; j <= E.numrows; j++) E.row[j].idx++;
+void editorSelectSyntaxHighlight(editorBuffer *b) {
+	b->syntax = NULL;
+	if (b->filename == NULL) return;
 
-	E.row[at].idx = at; //index of the row
-	
-	E.row[at].size = len;
-	E.row[at].chars = malloc(len + 1);
-	memcpy(E.row[at].chars, s, len);
-	E.row[at].chars[len] = '\0';
-	
-	E.row[at].rsize = 0;
-	E.row[at].render = NULL;
-	E.row[at].hl = NULL;
-	E.row[at].hl_open_comment = 0;
-	editorUpdateRow(&E.row[at]);
+	char *ext = strchr(b->filename, '.');
+	for (int j = 0; j < E.numsyntaxes && b->syntax == NULL; j++) { //loop through each syntax
+		struct editorSyntax *s = E.syntaxes[j];
+		unsigned int i = 0;
+		while (s->filematch[i]) { 				//loop through each syntax's filematch entries
+			int is_ext = (s->filematch[i][0] == '.');
+			if ((is_ext && ext && !strcmp(ext, s->filematch[i]))
+					|| (!is_ext && strstr(b->filename, s->filematch[i]))) {
+				b->syntax = s;
+				break;
+			}
+			i++;
+		}
+	}
+	editorHighlightRows(b, 0, b->numrows); 			//also clears the old colors when nothing matched
+}
+
+/*** syntax files ***/
+/* A definition is a file of "key value..." lines, blank lines & lines starting with '#' are skipped:
+ *	filetype python
+ *	match .py SConstruct 		extensions start with a '.', anything else matches part of the filename
+ *	keywords if elif else 		any number of keywords lines
+ *	types int str 			secondary keywords, colored differently
+ *	comment # 			starts a comment running to the end of the line
+ *	block_comment """ """ 		start & end of a comment that can span lines
+ *	strings "' 			turns on strings, quoted by any of these characters
+ *	numbers .xX 			turns on numbers, a number can go on with these characters after its first digit
+ * keywords can't contain separators, the highlighter looks words up whole. */
 
-	E.numrows++;
-	E.dirty++;
+void syntaxListAdd(char ***list, int *n, const char *item) {
+	*list = realloc(*list, sizeof(char *) * (*n + 2)); 	//stays NULL terminated
+	(*list)[(*n)++] = strdup(item);
+	(*list)[*n] = NULL;
 }
 
-void editorFreeRow(erow *row) {
-	free(row->render);
-	free(row->chars);
-	free(row->hl);
+void syntaxFree(struct editorSyntax *s) {
+	for (int j = 0; s->filematch && s->filematch[j]; j++) free(s->filematch[j]);
+	for (int j = 0; s->keywords && s->keywords[j]; j++) free(s->keywords[j]);
+	free(s->filematch);
+	free(s->keywords);
+	free(s->filetype);
+	free(s->singleline_comment_start);
+	free(s->multiline_comment_start);
+	free(s->multiline_comment_end);
+	free(s->quotes);
+	free(s->number_tail);
+	free(s->keyword_len);
+	free(s->keyword_hl);
+	free(s->keyword_hash);
+	free(s->cls);
+	free(s);
 }
 
-void editorDelRow(int at) {
-	if (at < 0 || at >= E.numrows) return;
-	editorFreeRow(&E.row[at]);
-	memmove(&E.row[at], &E.row[at+1], sizeof(erow) * (E.numrows - at - 1));
-	for (int j = at; j < E.numrows - 1; j++) E.row[j].idx--;
-	E.numrows--;
-	E.dirty++;
+//reads a definition file, NULL if it doesn't name a filetype & something to match
+struct editorSyntax *syntaxParse(const char *path) {
+	FILE *fp = fopen(path, "r");
+	if (!fp) return NULL;
+	struct editorSyntax *s = calloc(1, sizeof(struct editorSyntax));
+	int nmatch = 0, nkw = 0;
+	s->filematch = calloc(1, sizeof(char *)); 			//both lists are NULL terminated
+	s->keywords = calloc(1, sizeof(char *));
 
+	char *line = NULL;
+	size_t cap = 0;
+	while (getline(&line, &cap, fp) != -1) {
+		char *key = strtok(line, " \t\r\n");
+		if (key == NULL || key[0] == '#') continue;
+		char *arg = strtok(NULL, " \t\r\n");
+		if (!strcmp(key, "filetype") && arg) {
+			free(s->filetype);
+			s->filetype = strdup(arg);
+		} else if (!strcmp(key, "match") || !strcmp(key, "keywords") || !strcmp(key, "types")) {
+			for (; arg; arg = strtok(NULL, " \t\r\n")) {
+				if (key[0] == 'm') {
+					syntaxListAdd(&s->filematch, &nmatch, arg);
+				} else {
+					char word[256];
+					snprintf(word, sizeof(word), key[0] == 't' ? "%s|" : "%s", arg); 	//secondary keywords end with a pipe
+					syntaxListAdd(&s->keywords, &nkw, word);
+				}
+			}
+		} else if (!strcmp(key, "comment") && arg) {
+			free(s->singleline_comment_start);
+			s->singleline_comment_start = strdup(arg);
+		} else if (!strcmp(key, "block_comment") && arg) {
+			char *end = strtok(NULL, " \t\r\n");
+			if (end == NULL) continue;
+			free(s->multiline_comment_start);
+			free(s->multiline_comment_end);
+			s->multiline_comment_start = strdup(arg);
+			s->multiline_comment_end = strdup(end);
+		} else if (!strcmp(key, "strings") && arg) {
+			free(s->quotes);
+			s->quotes = strndup(arg, KILO_SYNTAX_QUOTES);
+			s->flags |= HL_HIGHLIGHT_STRINGS;
+		} else if (!strcmp(key, "numbers")) {
+			free(s->number_tail);
+			s->number_tail = strdup(arg ? arg : "");
+			s->flags |= HL_HIGHLIGHT_NUMBERS;
+		}
+	}
+	free(line);
+	fclose(fp);
+	if (s->filetype == NULL || nmatch == 0) {
+		syntaxFree(s);
+		return NULL;
+	}
+	if (s->quotes == NULL) s->quotes = strdup("");
+	return s;
 }
 
-void editorRowInsertChar(erow *row, int at, int c) {
-	if (at < 0 || at > row->size) at = row->size; 				//validate at
-	row->chars = realloc(row->chars, row->size + 2); 			//make space for character to insert & null byte
-	memmove(&row->chars[at+1], &row->chars[at], row->size - at + 1); 	//I believe this is moving the final character, a null byte, to the new end of string
-	row->size++; 								//inrement row size
-	row->chars[at] = c; 							//insert the new caracter
-	editorUpdateRow(row); 							//update row
-	E.dirty++;
+//the cache is the compiled syntaxes written out field by field, strings as a length (-1 for NULL) & their bytes
+void syntaxWriteInt(FILE *fp, int v) {
+	fwrite(&v, sizeof(v), 1, fp);
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len) {
-	row->chars = realloc(row->chars, row->size + len + 1);
-	memcpy(&row->chars[row->size], s, len);
-	row->size += len;
-	row->chars[row->size] = '\0';
-	editorUpdateRow(row);
-	E.dirty++;
+void syntaxWriteStr(FILE *fp, const char *str) {
+	int len = str ? (int)strlen(str) : -1;
+	syntaxWriteInt(fp, len);
+	if (len > 0) fwrite(str, 1, len, fp);
 }
 
-void editorRowDelChar(erow *row, int at) {
-	if (at < 0 || at >= row->size) return;
-	memmove(&row->chars[at], &row->chars[at+1], row->size - at);
-	row->size--;
-	editorUpdateRow(row);
-	E.dirty++;
+void syntaxWriteList(FILE *fp, char **list) {
+	int n = 0;
+	while (list[n]) n++;
+	syntaxWriteInt(fp, n);
+	for (int j = 0; j < n; j++) syntaxWriteStr(fp, list[j]);
 }
 
-/*** editor operations ***/
-void editorInsertChar(int c) {
-	if (E.cy == E.numrows) { 			//if the cursor is at the end of the file
-		editorInsertRow(E.numrows, "",0); 			//append a blank row
-	}
-	editorRowInsertChar(&E.row[E.cy], E.cx, c); 	//insert the character into the row, and column, marked by the cursor
-	E.cx++; 					//increment the column cursor after inserting the character
+void syntaxWrite(FILE *fp, struct editorSyntax *s) {
+	syntaxWriteStr(fp, s->filetype);
+	syntaxWriteStr(fp, s->singleline_comment_start);
+	syntaxWriteStr(fp, s->multiline_comment_start);
+	syntaxWriteStr(fp, s->multiline_comment_end);
+	syntaxWriteStr(fp, s->quotes);
+	syntaxWriteStr(fp, s->number_tail);
+	syntaxWriteInt(fp, s->flags);
+	syntaxWriteList(fp, s->filematch);
+	syntaxWriteList(fp, s->keywords);
+	syntaxWriteInt(fp, s->hash_mask); 			//the rest is rebuilt by syntaxCompileTables
+	fwrite(s->keyword_hash, sizeof(int), s->hash_mask + 1, fp);
 }
 
-void editorInsertNewLine() {
-	if (E.cx == 0) { 							//if we are at the beginning of the line
-		editorInsertRow(E.cy, "",0); 					//just insert a row
-	} else { 								//if we are within a line
-		erow *row = &E.row[E.cy]; 					//get the rows address
-		editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx); 	//split the current line and move the string to the right of the cursor to the new-line
-		row = &E.row[E.cy]; 						//row pointer could have been reassigned in editorInsertRow
-		row->size = E.cx; 						//update the row-size to the cursor position
-		row->chars[row->size] = '\0'; 					//add a nullbyte
-		editorUpdateRow(row);
+//the readers do nothing once *ok is 0, so a short or damaged cache is only checked for at the end
+int syntaxReadInt(FILE *fp, int *ok) {
+	int v = 0;
+	if (*ok && fread(&v, sizeof(v), 1, fp) != 1) *ok = 0;
+	return v;
+}
+
+char *syntaxReadStr(FILE *fp, int *ok) {
+	int len = syntaxReadInt(fp, ok);
+	if (!*ok || len == -1) return NULL;
+	if (len < 0 || len > 4096) {
+		*ok = 0;
+		return NULL;
 	}
-	E.cy++;
-	E.cx = 0;
+	char *str = malloc(len + 1);
+	if (fread(str, 1, len, fp) != (size_t)len) *ok = 0;
+	str[len] = '\0';
+	return str;
 }
 
-void editorDelChar() {
-	if (E.cy == E.numrows) return; 			//if the cursor is at the end of the file, we cannot delete anything
-	erow *row = &E.row[E.cy];
-	if (E.cx > 0) {
-		editorRowDelChar(row, E.cx - 1); 	//delete the character in the current row at the current column
-		E.cx--; 					//decrement the column cursor after deleting the character
-	} else {
-		E.cx = E.row[E.cy - 1].size;
-		editorRowAppendString(&E.row[E.cy-1], row->chars, row->size);
-		editorDelRow(E.cy);
-		E.cy--;
+char **syntaxReadList(FILE *fp, int *n, int *ok) {
+	*n = syntaxReadInt(fp, ok);
+	if (!*ok || *n < 0 || *n > 65536) {
+		*ok = 0;
+		*n = 0;
 	}
+	char **list = calloc(*n + 1, sizeof(char *));
+	for (int j = 0; j < *n; j++) list[j] = syntaxReadStr(fp, ok);
+	for (int j = 0; j < *n; j++) if (list[j] == NULL) *ok = 0;
+	return list;
 }
 
-/*** file I/O ***/
-char *editorRowsToString(int *buflen) {
-	int totlen = 0; 					//sum of the length of all rows + a new-line character for each
-	int j; 							//iterator
-	for (j = 0; j < E.numrows; j++) 			//for-each row
-		totlen += E.row[j].size + 1; 			//add a row & its new-line to the total
-	*buflen = totlen; 					//set the buffer length
+//reads back what syntaxWrite wrote. the hash is checked & the other tables are rebuilt, so a damaged cache can't crash us
+struct editorSyntax *syntaxRead(FILE *fp) {
+	int ok = 1, nmatch;
+	struct editorSyntax *s = calloc(1, sizeof(struct editorSyntax));
+	s->filetype = syntaxReadStr(fp, &ok);
+	s->singleline_comment_start = syntaxReadStr(fp, &ok);
+	s->multiline_comment_start = syntaxReadStr(fp, &ok);
+	s->multiline_comment_end = syntaxReadStr(fp, &ok);
+	s->quotes = syntaxReadStr(fp, &ok);
+	s->number_tail = syntaxReadStr(fp, &ok);
+	s->flags = syntaxReadInt(fp, &ok);
+	s->filematch = syntaxReadList(fp, &nmatch, &ok);
+	s->keywords = syntaxReadList(fp, &s->nkeywords, &ok);
+	int n = s->nkeywords;
+	s->hash_mask = syntaxReadInt(fp, &ok);
+	if (s->hash_mask < 7 || s->hash_mask > (1 << 20) || (s->hash_mask & (s->hash_mask + 1))) ok = 0;
+	if (ok) {
+		s->keyword_hash = malloc(sizeof(int) * (s->hash_mask + 1));
+		if (fread(s->keyword_hash, sizeof(int), s->hash_mask + 1, fp) != (size_t)s->hash_mask + 1) ok = 0;
+	}
 
-	char *buf = malloc(totlen); 				//allocate a buffer to hold all the rows
-	char *p = buf; 						//pointer to end of buffer
-	for (j=0; j< E.numrows; j++) { 				//for-each row in rows
-		memcpy(p, E.row[j].chars, E.row[j].size); 	//copy the current row into the end of the buffer
-		p += E.row[j].size; 				//move the pointer to the end of the buffer
-		*p = '\n'; 					//add a new-line character
-		p++; 						//move pointer to end of buffer again
+	if (ok) { 								//the hash has to agree with the definition it came from
+		if (s->filetype == NULL || s->quotes == NULL || nmatch == 0 || (int)strlen(s->quotes) > KILO_SYNTAX_QUOTES)
+			ok = 0;
+		int empty = 0; 							//a lookup probes until it finds an empty slot
+		for (int j = 0; ok && j <= s->hash_mask; j++) {
+			if (s->keyword_hash[j] < -1 || s->keyword_hash[j] >= n) ok = 0;
+			if (s->keyword_hash[j] == -1) empty = 1;
+		}
+		if (!empty) ok = 0;
 	}
-	return buf; 						//expect the caller to free memory
+	if (ok) syntaxCompileTables(s); 					//lengths, classes & the rest, from the strings
+	if (!ok) {
+		syntaxFree(s);
+		return NULL;
+	}
+	return s;
 }
 
-void editorOpen(char* filename) {
-	free(E.filename);
-	E.filename = strdup(filename);
+int syntaxNameCmp(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
 
-	editorSelectSyntaxHighlight();
+void editorAddSyntax(struct editorSyntax *s) {
+	E.syntaxes = realloc(E.syntaxes, sizeof(struct editorSyntax *) * (E.numsyntaxes + 1));
+	E.syntaxes[E.numsyntaxes++] = s;
+}
 
-	FILE *fp = fopen(filename, "r");
-	if (!fp) die("fopen");
+//loads the *.syntax definitions, from the cache if no file changed since it was written, then the built in ones
+void editorLoadSyntaxes() {
+	char dir[1024], cache[1024], tmp[1100];
+	const char *home = getenv("HOME");
+	const char *env = getenv("KILO_SYNTAX_DIR");
+	if (env) snprintf(dir, sizeof(dir), "%s", env);
+	else snprintf(dir, sizeof(dir), "%s/%s", home ? home : ".", KILO_SYNTAX_DIR);
+	cache[0] = '\0';
+	if (home) snprintf(cache, sizeof(cache), "%s/%s", home, KILO_SYNTAX_CACHE);
 
-	char* line = NULL;
-	size_t linecap = 0;
-	ssize_t linelen;
-	while((linelen = getline(&line, &linecap, fp)) != -1) {
-		while (linelen > 0 &&
-				(line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-			linelen--;
-		editorInsertRow(E.numrows,line,linelen);
+	char **names = NULL; 						//the definition files, sorted so the order is stable
+	int nnames = 0;
+	DIR *d = opendir(dir);
+	struct dirent *de;
+	while (d && (de = readdir(d)) != NULL) {
+		size_t len = strlen(de->d_name);
+		if (len > 7 && !strcmp(de->d_name + len - 7, ".syntax"))
+			syntaxListAdd(&names, &nnames, de->d_name);
 	}
-	free(line);
-	fclose(fp);
-	E.dirty = 0;
-}
+	if (d) closedir(d);
+	if (nnames) qsort(names, nnames, sizeof(char *), syntaxNameCmp);
 
-void editorSave() {
-	if (E.filename == NULL) { 				//no file to save to
-		E.filename = editorPrompt("Save as %s", NULL); 	//prompt for a file-name
-		if (E.filename == NULL) {
-			editorSetStatusMessage("Save aborted");
-			return;
-		}
-		editorSelectSyntaxHighlight();
+	unsigned long long sig = 14695981039346656037ull; 		//FNV-1a of the directory & the name, size & mtime of each file
+	char stamp[1400];
+	int stamplen = snprintf(stamp, sizeof(stamp), "%s", dir);
+	for (int j = 0; j <= nnames; j++) {
+		for (int k = 0; k < stamplen; k++) sig = (sig ^ (unsigned char)stamp[k]) * 1099511628211ull;
+		if (j == nnames) break;
+		struct stat st;
+		snprintf(tmp, sizeof(tmp), "%s/%s", dir, names[j]);
+		if (stat(tmp, &st) == -1) memset(&st, 0, sizeof(st));
+		stamplen = snprintf(stamp, sizeof(stamp), "%s %lld %lld.%ld", names[j],
+				(long long)st.st_size, (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
 	}
 
-	int len; 						//the length of the buffer
-	char *buf = editorRowsToString(&len); 			//pointer to the buffer
-
-	int fd = open(E.filename, O_RDWR | O_CREAT, 0644); 	//open for RW / create, a file with chmod 0644 
-	if (fd != -1) {
-		if(ftruncate(fd,len) != -1) { 			//sets the file-size to a specific length. Helps with data-loss prevention?
-			if (write(fd,buf,len) == len) { 	//write the buffer of length to the file
-				close(fd); 			//close the file
-				free(buf); 			//free the buffer
-				editorSetStatusMessage("%d bytes written to disk", len);
-				E.dirty = 0;
-				return;
+	int loaded = 0;
+	FILE *fp = (nnames && cache[0]) ? fopen(cache, "rb") : NULL;
+	if (fp) {
+		int ok = 1;
+		unsigned long long file_sig = 0;
+		if (syntaxReadInt(fp, &ok) != (int)KILO_SYNTAX_MAGIC || syntaxReadInt(fp, &ok) != KILO_SYNTAX_VERSION) ok = 0;
+		if (ok && fread(&file_sig, sizeof(file_sig), 1, fp) != 1) ok = 0;
+		int count = syntaxReadInt(fp, &ok);
+		if (ok && file_sig == sig && count >= 0 && count <= nnames) {
+			struct editorSyntax **list = calloc(count + 1, sizeof(struct editorSyntax *));
+			int j;
+			for (j = 0; j < count; j++)
+				if ((list[j] = syntaxRead(fp)) == NULL) break;
+			if (j == count) { 				//all or nothing
+				for (j = 0; j < count; j++) editorAddSyntax(list[j]);
+				loaded = 1;
+			} else {
+				while (j-- > 0) syntaxFree(list[j]);
 			}
+			free(list);
 		}
-		close(fd);
+		fclose(fp);
 	}
-	free(buf);
-	editorSetStatusMessage("Failed to save. I/O Error: %s", strerror(errno));
-}
+	if (!loaded && nnames) {
+		int first = E.numsyntaxes;
+		for (int j = 0; j < nnames; j++) {
+			snprintf(tmp, sizeof(tmp), "%s/%s", dir, names[j]);
+			struct editorSyntax *s = syntaxParse(tmp);
+			if (s == NULL) continue;
+			syntaxCompile(s);
+			editorAddSyntax(s);
+		}
+		if (cache[0]) { 					//written next to it & renamed, so a reader never sees half a cache
+			snprintf(tmp, sizeof(tmp), "%s/.kilo", home);
+			mkdir(tmp, 0700);
+			snprintf(tmp, sizeof(tmp), "%s.tmp", cache);
+			fp = fopen(tmp, "wb");
+			if (fp) {
+				syntaxWriteInt(fp, (int)KILO_SYNTAX_MAGIC);
+				syntaxWriteInt(fp, KILO_SYNTAX_VERSION);
+				fwrite(&sig, sizeof(sig), 1, fp);
+				syntaxWriteInt(fp, E.numsyntaxes - first);
+				for (int j = first; j < E.numsyntaxes; j++) syntaxWrite(fp, E.syntaxes[j]);
+				if (fclose(fp) == 0) rename(tmp, cache);
+				else unlink(tmp);
+			}
+		}
+	}
+	for (int j = 0; j < nnames; j++) free(names[j]);
+	free(names);
 
-/*** find ***/
+	for (unsigned int j = 0; j < HLDB_ENTRIES; j++) { 		//the built in syntaxes come last, so files can replace them
+		syntaxCompile(&HLDB[j]);
+		editorAddSyntax(&HLDB[j]);
+	}
+}
+/*** utf-8 ***/
+//decodes the character at p, returns its length in bytes. *cp is -1 for a byte that doesn't start a valid character
+int utf8Decode(const char *p, int len, int *cp) {
+	unsigned char c = p[0];
+	int n, min, v;
+	if (c < 0x80) {
+		*cp = c;
+		return 1;
+	}
+	if (c >= 0xc2 && c <= 0xdf) 		{ n = 2; v = c & 0x1f; min = 0x80; }
+	else if (c >= 0xe0 && c <= 0xef) 	{ n = 3; v = c & 0x0f; min = 0x800; }
+	else if (c >= 0xf0 && c <= 0xf4) 	{ n = 4; v = c & 0x07; min = 0x10000; }
+	else 					{ *cp = -1; return 1; }
+	if (n > len) {
+		*cp = -1;
+		return 1;
+	}
+	for (int j = 1; j < n; j++) {
+		unsigned char cc = p[j];
+		if ((cc & 0xc0) != 0x80) { 		//not a continuation byte
+			*cp = -1;
+			return 1;
+		}
+		v = (v << 6) | (cc & 0x3f);
+	}
+	if (v < min || v > 0x10ffff || (v >= 0xd800 && v <= 0xdfff)) { 	//overlong, out of range or a surrogate
+		*cp = -1;
+		return 1;
+	}
+	*cp = v;
+	return n;
+}
 
-//finds a string in the file
-void editorFindCallback(char* query, int key) {
-	static int last_match = -1;
-	static int direction = 1;
+//ranges of code points that take no column (combining marks & the like) or two (CJK, Hangul, fullwidth forms, emoji)
+static const int utf8_zero_width[][2] = {
+	{0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf}, {0x05c1, 0x05c2},
+	{0x05c4, 0x05c5}, {0x05c7, 0x05c7}, {0x0610, 0x061a}, {0x064b, 0x065f}, {0x0670, 0x0670},
+	{0x06d6, 0x06dc}, {0x06df, 0x06e4}, {0x06e7, 0x06e8}, {0x06ea, 0x06ed}, {0x0900, 0x0902},
+	{0x093a, 0x093a}, {0x093c, 0x093c}, {0x0941, 0x0948}, {0x094d, 0x094d}, {0x0951, 0x0957},
+	{0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff},
+	{0x200b, 0x200f}, {0x202a, 0x202e}, {0x2060, 0x2064}, {0x20d0, 0x20ff}, {0xfe00, 0xfe0f},
+	{0xfe20, 0xfe2f}, {0xfeff, 0xfeff}, {0x1f3fb, 0x1f3ff}, {0xe0000, 0xe0fff},
+};
+static const int utf8_wide[][2] = {
+	{0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec}, {0x23f0, 0x23f0},
+	{0x23f3, 0x23f3}, {0x25fd, 0x25fe}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267f, 0x267f},
+	{0x2693, 0x2693}, {0x26a1, 0x26a1}, {0x26aa, 0x26ab}, {0x26bd, 0x26be}, {0x26c4, 0x26c5},
+	{0x26ce, 0x26ce}, {0x26d4, 0x26d4}, {0x26ea, 0x26ea}, {0x26f2, 0x26f3}, {0x26f5, 0x26f5},
+	{0x26fa, 0x26fa}, {0x26fd, 0x26fd}, {0x2705, 0x2705}, {0x270a, 0x270b}, {0x2728, 0x2728},
+	{0x274c, 0x274c}, {0x274e, 0x274e}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+	{0x27b0, 0x27b0}, {0x27bf, 0x27bf}, {0x2b1b, 0x2b1c}, {0x2b50, 0x2b50}, {0x2b55, 0x2b55},
+	{0x2e80, 0x303e}, {0x3041, 0x33ff}, {0x3400, 0x4dbf}, {0x4e00, 0x9fff}, {0xa000, 0xa4cf},
+	{0xa960, 0xa97f}, {0xac00, 0xd7a3}, {0xf900, 0xfaff}, {0xfe10, 0xfe19}, {0xfe30, 0xfe6f},
+	{0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x16fe0, 0x16fe4}, {0x17000, 0x18cff}, {0x1b000, 0x1b2ff},
+	{0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f200, 0x1f251},
+	{0x1f300, 0x1f320}, {0x1f32d, 0x1f335}, {0x1f337, 0x1f37c}, {0x1f37e, 0x1f393}, {0x1f3a0, 0x1f3ca},
+	{0x1f3cf, 0x1f3d3}, {0x1f3e0, 0x1f3f0}, {0x1f3f4, 0x1f3f4}, {0x1f3f8, 0x1f43e}, {0x1f440, 0x1f440},
+	{0x1f442, 0x1f4fc}, {0x1f4ff, 0x1f53d}, {0x1f54b, 0x1f54e}, {0x1f550, 0x1f567}, {0x1f57a, 0x1f57a},
+	{0x1f595, 0x1f596}, {0x1f5a4, 0x1f5a4}, {0x1f5fb, 0x1f64f}, {0x1f680, 0x1f6c5}, {0x1f6cc, 0x1f6cc},
+	{0x1f6d0, 0x1f6d2}, {0x1f6d5, 0x1f6d7}, {0x1f6eb, 0x1f6ec}, {0x1f6f4, 0x1f6fc}, {0x1f7e0, 0x1f7eb},
+	{0x1f90c, 0x1f93a}, {0x1f93c, 0x1f945}, {0x1f947, 0x1f9ff}, {0x1fa70, 0x1faff}, {0x20000, 0x2fffd},
+	{0x30000, 0x3fffd},
+};
 
-	static int saved_hl_line;
-	static char *saved_hl = NULL;
-	if (saved_hl) {
-		memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-		free(saved_hl);
-		saved_hl = NULL;
+int utf8InTable(int cp, const int (*table)[2], int n) {
+	int lo = 0, hi = n - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (cp < table[mid][0]) hi = mid - 1;
+		else if (cp > table[mid][1]) lo = mid + 1;
+		else return 1;
 	}
+	return 0;
+}
 
-	if (key == '\r' || key == '\x1b') { 			//IF ESCAPE OR RETURN
-		last_match = -1; 				//reset last_match on exiting search
-		direction = 1; 					//reset direction on exiting search
+//columns a code point takes on screen. control characters & bytes that aren't valid UTF-8 are drawn as one symbol
+int utf8Width(int cp) {
+	if (cp < 0x300) return 1;
+	if (utf8InTable(cp, utf8_zero_width, sizeof(utf8_zero_width) / sizeof(utf8_zero_width[0]))) return 0;
+	if (utf8InTable(cp, utf8_wide, sizeof(utf8_wide) / sizeof(utf8_wide[0]))) return 2;
+	return 1;
+}
+
+//whether a string is all ASCII, 16 bytes at a time where we can
+int utf8IsAscii(const char *p, int len) {
+	int i = 0;
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 16 <= len; i += 16) acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(p + i)));
+	if (_mm_movemask_epi8(acc)) return 0; 		//some byte had its high bit set
+#endif
+	for (; i < len; i++)
+		if (p[i] & 0x80) return 0;
+	return 1;
+}
+
+/*** row operations ***/
+//moves pos over one character of a row, a tab takes it to the next tab stop
+void editorRowStep(erow *row, struct rowCol *pos) {
+	if (row->chars[pos->cx] == '\t') {
+		int w = KILO_TAB_STOP - pos->col % KILO_TAB_STOP;
+		pos->cx++;
+		pos->rx += w;
+		pos->col += w;
 		return;
-	} else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-		direction = 1;
-	} else if (key == ARROW_LEFT || key == ARROW_UP) {
-		direction = -1;
-	} else {
-		direction = 1;
-		last_match = -1;
 	}
-	if (last_match == -1) direction = 1;
-	int current = last_match; 				//index of the current row we are searching
-	int i;
-	for (i = 0; i < E.numrows; i++) { 			//FOR-EACH row in the editor
-		current += direction; 				//decrement if we are searching backwards, increment if we are moving forwards
-		if (current == -1) current = E.numrows - 1; 	//if the current match was moved to before the file, wrap around to the end of the file
-		else if (current == E.numrows) current = 0; 	//IF the current match is at the end of the file, move to the beginning of the file
+	int cp;
+	int n = utf8Decode(&row->chars[pos->cx], row->size - pos->cx, &cp);
+	pos->cx += n;
+	pos->rx += n;
+	pos->col += utf8Width(cp);
+}
 
-		erow *row = &E.row[current]; 			//set var to current row
-		char *match = strstr(row->render, query); 	//returns a pointer to the first occurence of the QUERY in the row
-		if (match) { 					//if the pointer is not NULL, meaning we have a match
-			last_match = current; 			//update the last_match to be the current match
-			E.cy = current; 			//set the cursor to the current row
-			E.cx = editorRowRxtoCx(row,match - row->render); 		//set the cursor to the beginning of the match
-			E.row_off = E.numrows;  		//set row_offset to the bottom of the file so that the editorScroll will bring us to the matching line(top of screen)
-
-			saved_hl_line = current;
-			saved_hl = malloc(row->size);
-			memcpy(saved_hl, row->hl, row->rsize);
-			memset(&row->hl[match - row->render], HL_MATCH, strlen(query)); //highlight the match
-			break; 					//break to end the search
-		}
+//records where the first character at or after every KILO_COL_BLOCK bytes of chars is, in render & on screen
+void editorRowBuildColumns(erow *row) {
+	int n = row->size / KILO_COL_BLOCK + 1;
+	row->cols = malloc(sizeof(struct rowCol) * n);
+	struct rowCol pos = {0, 0, 0};
+	for (int k = 0; k < n; k++) {
+		while (pos.cx < k * KILO_COL_BLOCK) editorRowStep(row, &pos);
+		row->cols[k] = pos;
 	}
 }
-//editor find, calls callback
-void editorFind() {
-	//save context information
-	int saved_cx = E.cx;
-	int saved_cy = E.cy;
-	int saved_coloff = E.col_off;
-	int saved_rowoff = E.row_off;
 
-	char *query = editorPrompt("Search %s (ESC to cancel/ARROWS to navigate/Enter to find)", editorFindCallback);
-	if (query) free(query); 				//free the query, if it exists
-	else {
-		//restore context
-		E.cx 		= saved_cx; 
-		E.cy 		= saved_cy; 
-		E.col_off 	= saved_coloff; 
-		E.row_off 	= saved_rowoff; 
+int rowColKey(struct rowCol *pos, int by) {
+	return by == COL_BY_CX ? pos->cx : by == COL_BY_RX ? pos->rx : pos->col;
+}
+
+//finds the last character of a row that starts at or before value, a chars index, render index or display column.
+//a binary search over the column index & at most KILO_COL_BLOCK bytes of stepping, so moving around long lines stays cheap
+struct rowCol editorRowSeek(erow *row, int by, int value) {
+	struct rowCol pos;
+	if (row->plain) { 					//every byte is one column
+		if (value > row->size) value = row->size;
+		if (value < 0) value = 0;
+		pos.cx = pos.rx = pos.col = value;
+		return pos;
 	}
+	if (row->cols == NULL) editorRowBuildColumns(row);
+	int lo = 0, hi = row->size / KILO_COL_BLOCK; 		//the last checkpoint at or before value
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (rowColKey(&row->cols[mid], by) <= value) lo = mid;
+		else hi = mid - 1;
+	}
+	pos = row->cols[lo];
+	while (pos.cx < row->size) {
+		struct rowCol next = pos;
+		editorRowStep(row, &next);
+		if (rowColKey(&next, by) > value) break;
+		pos = next;
+	}
+	return pos;
 }
 
-/*** append buffer ***/
-/* To reduce the amount of write() calls we make. Thus, reducing flicker & unexpected behavior */
+int editorRowCxtoRx(erow *row, int cx) { 	//converts a character index into a display column
+	return editorRowSeek(row, COL_BY_CX, cx).col;
+}
+
+int editorRowRxtoCx(erow *row, int rx) { 	//converts a display column into the index of the character on it
+	return editorRowSeek(row, COL_BY_COL, rx).cx;
+}
+
+//the index after the character at cx, combining marks after it go with it
+int editorRowNextChar(erow *row, int cx) {
+	int cp;
+	if (cx >= row->size) return row->size;
+	cx += utf8Decode(&row->chars[cx], row->size - cx, &cp);
+	while (cx < row->size) {
+		int n = utf8Decode(&row->chars[cx], row->size - cx, &cp);
+		if (cp < 0 || utf8Width(cp) != 0) break;
+		cx += n;
+	}
+	return cx;
+}
+
+//the index of the character before cx, skipping back over combining marks to the character they sit on
+int editorRowPrevChar(erow *row, int cx) {
+	while (cx > 0) {
+		int j = cx - 1;
+		while (j > 0 && cx - j < 4 && (row->chars[j] & 0xc0) == 0x80) j--; 	//back to the lead byte
+		int cp;
+		if (utf8Decode(&row->chars[j], row->size - j, &cp) != cx - j) { 	//not a whole character, a stray byte
+			j = cx - 1;
+			cp = -1;
+		}
+		cx = j;
+		if (cp < 0 || utf8Width(cp) != 0) break;
+	}
+	return cx;
+}
+
+//bytes held by the caches of a row, render & hl can always be rebuilt from chars
+size_t editorRowCacheSize(erow *row) {
+	size_t bytes = sizeof(struct hlSpan) * row->hlcap;
+	if (row->render != NULL && row->render != row->chars) bytes += row->rsize + 1; 	//a shared render costs nothing extra
+	return bytes;
+}
+
+//frees render unless it is chars itself
+void editorRowDropRender(erow *row) {
+	if (row->render != row->chars) free(row->render);
+	row->render = NULL;
+	free(row->cols); 				//the column index goes with render
+	row->cols = NULL;
+	row->plain = 0;
+}
+
+//must be called before chars is realloc'd, a render that points at it would be left dangling
+void editorRowUnshare(erow *row) {
+	if (row->render == row->chars) row->render = NULL; 	//shared, so it was never counted in cache_bytes
+}
+
+//builds the render string of a row from chars, touches nothing but the row so the loader thread can use it too
+void editorRowRender(erow *row) {
+	editorRowDropRender(row);
+	int ascii = utf8IsAscii(row->chars, row->size);
+	if (memchr(row->chars, '\t', row->size) == NULL) { 	//nothing to expand, so render is chars
+		row->render = row->chars;
+		row->rsize = row->size;
+		row->plain = ascii;
+		return;
+	}
+	int tabs = 0; 					//total tabs found in row
+	int j; 						//iteration variable
+	for (j = 0; j < row->size; j++) 		//for-each character in the row
+		if (row->chars[j] == '\t') tabs++; 	//if character = tab, tab++
+	row->render = malloc(row->size + tabs*(KILO_TAB_STOP-1) + 1); 	//malloc the render string with extra-space allocated for spaces, TAB_STOP-1 because \t' =1
+
+	int idx = 0; 					//contains the number of letters copied into row->render
+	if (ascii) { 					//a byte is a column, so tab stops fall on render indexes
+		for (j = 0; j < row->size; j++) {
+			if (row->chars[j] == '\t') {
+				row->render[idx++] = ' ';
+				while (idx % KILO_TAB_STOP != 0)
+					row->render[idx++] = ' ';
+			}
+			else {
+				row->render[idx++] = row->chars[j];
+			}
+		}
+	} else { 					//tab stops are display columns, wide characters & multibyte ones move them
+		struct rowCol pos = {0, 0, 0};
+		while (pos.cx < row->size) {
+			struct rowCol next = pos;
+			editorRowStep(row, &next);
+			if (row->chars[pos.cx] == '\t') memset(&row->render[idx], ' ', next.col - pos.col);
+			else memcpy(&row->render[idx], &row->chars[pos.cx], next.cx - pos.cx);
+			idx += next.rx - pos.rx;
+			pos = next;
+		}
+	}
+	row->render[idx] = '\0';
+	row->rsize = idx;
+}
+
+void editorUpdateRow(editorBuffer *b, erow *row) {
+	if (row->chars == NULL) { 			//evicted, inflating the span it is in updates the row
+		editorGzRestore(b, row->idx);
+		return;
+	}
+	b->cache_bytes -= editorRowCacheSize(row); 	//the old caches are about to be replaced
+	editorRowRender(row);
+	b->cache_bytes += editorRowCacheSize(row);
+	editorIndexRow(b, row); 			//the row may take more or fewer screen lines & bytes now
+	editorUpdateSyntax(b, row); 			//accounts for the spans it allocates itself
+}
+
+//makes sure a row has its render & hl caches, they may have been released while the buffer was hidden
+void editorRowEnsureCache(editorBuffer *b, erow *row) {
+	if (row->render == NULL) editorUpdateRow(b, row);
+}
+
+//frees the render & hl caches of every row in a buffer, the rows are rebuilt as they are displayed again
+//an unmodified compressed buffer gives up chars as well, they are inflated again from the nearest seek point
+void editorReleaseCaches(editorBuffer *b) {
+	int evict = (b->gz && b->gz->have > 0 && b->dirty == 0 && !editorFilterViews(b)); 	//filter views point at chars
+	for (int j = 0; j < b->numrows; j++) {
+		editorRowDropRender(&b->row[j]);
+		free(b->row[j].hl);
+		b->row[j].hl = NULL;
+		b->row[j].nhl = 0;
+		b->row[j].hlcap = 0;
+		b->row[j].rsize = 0;
+		if (evict) { 				//size is kept, the cursor can move over evicted rows
+			free(b->row[j].chars);
+			b->row[j].chars = NULL;
+		}
+	}
+	b->cache_bytes = 0;
+	if (evict) b->evicted = 1;
+}
+
+//inflates every evicted row of a buffer again
+void editorRestoreText(editorBuffer *b) {
+	if (!b->evicted) return;
+	for (int j = 0; j < b->numrows; j++)
+		if (b->row[j].chars == NULL) editorGzRestore(b, j);
+	b->evicted = 0;
+}
+
+//makes room for one more row, the array grows by doubling so appending a file line by line stays linear
+void editorGrowRows(editorBuffer *b) {
+	if (b->numrows < b->rowcap) return;
+	b->rowcap = b->rowcap ? b->rowcap * 2 : 16;
+	b->row = realloc(b->row, sizeof(erow) * b->rowcap);
+}
+
+void editorInsertRow(editorBuffer *b, int at, const char *s, size_t len) {
+	if (at < 0 || at > b->numrows) return;
+	editorGrowRows(b);
+	memmove(&b->row[at+1], &b->row[at], sizeof(erow) * (b->numrows - at));
+	for (int j = at + 1; j <= b->numrows; j++) b->row[j].idx++;
+
+	b->row[at].idx = at; //index of the row
+	
+	b->row[at].size = len;
+	b->row[at].chars = malloc(len + 1);
+	memcpy(b->row[at].chars, s, len);
+	b->row[at].chars[len] = '\0';
+	
+	b->row[at].rsize = 0;
+	b->row[at].render = NULL;
+	b->row[at].hl = NULL;
+	b->row[at].nhl = 0;
+	b->row[at].hlcap = 0;
+	b->row[at].plain = 0;
+	b->row[at].cols = NULL;
+	b->row[at].vlines = 0;
+	b->row[at].crlf = 0;
+	b->row[at].hl_open_comment = 0;
+	if (at < b->numrows) { 			//the rows after it moved down, the trees are rebuilt when they are next used
+		b->wrap_tree.stale = 1;
+		b->offsets.stale = 1;
+	} 					//else editorIndexRow appends it to them, like editorAppendRows
+	editorUpdateRow(b, &b->row[at]);
+
+	b->numrows++;
+	b->dirty++;
+	b->gen++;
+}
+
+void editorFreeRow(editorBuffer *b, erow *row) {
+	b->cache_bytes -= editorRowCacheSize(row);
+	editorRowDropRender(row);
+	if (b->source == NULL) free(row->chars); 	//a filter view only borrows its text
+	free(row->hl);
+}
+
+void editorDelRow(editorBuffer *b, int at) {
+	if (at < 0 || at >= b->numrows) return;
+	editorFreeRow(b, &b->row[at]);
+	memmove(&b->row[at], &b->row[at+1], sizeof(erow) * (b->numrows - at - 1));
+	for (int j = at; j < b->numrows - 1; j++) b->row[j].idx--;
+	b->numrows--;
+	b->wrap_tree.stale = 1;
+	b->offsets.stale = 1;
+	b->dirty++;
+	b->gen++;
+}
+
+void editorRowInsertChar(editorBuffer *b, erow *row, int at, int c) {
+	if (at < 0 || at > row->size) at = row->size; 				//validate at
+	editorRowUnshare(row);
+	row->chars = realloc(row->chars, row->size + 2); 			//make space for character to insert & null byte
+	memmove(&row->chars[at+1], &row->chars[at], row->size - at + 1); 	//I believe this is moving the final character, a null byte, to the new end of string
+	row->size++; 								//inrement row size
+	row->chars[at] = c; 							//insert the new caracter
+	editorUpdateRow(b, row); 							//update row
+	b->dirty++;
+	b->gen++;
+}
+
+void editorRowAppendString(editorBuffer *b, erow *row, const char *s, size_t len) {
+	editorRowUnshare(row);
+	row->chars = realloc(row->chars, row->size + len + 1);
+	memcpy(&row->chars[row->size], s, len);
+	row->size += len;
+	row->chars[row->size] = '\0';
+	editorUpdateRow(b, row);
+	b->dirty++;
+	b->gen++;
+}
+
+//deletes the character at 'at', which takes len bytes of chars
+void editorRowDelChar(editorBuffer *b, erow *row, int at, int len) {
+	if (at < 0 || at >= row->size) return;
+	if (len > row->size - at) len = row->size - at;
+	memmove(&row->chars[at], &row->chars[at+len], row->size - at - len + 1);
+	row->size -= len;
+	editorUpdateRow(b, row);
+	b->dirty++;
+	b->gen++;
+}
+
+/*** row trees ***/
+void rowTreeAdd(struct rowTree *t, int idx, long long delta) {
+	for (int i = idx + 1; i <= t->n; i += i & -i) t->sum[i] += delta;
+}
+
+//the total of the rows before row idx
+long long rowTreePrefix(struct rowTree *t, int idx) {
+	long long sum = 0;
+	for (int i = idx; i > 0; i -= i & -i) sum += t->sum[i];
+	return sum;
+}
+
+//the row a running total of v falls in, *off is how far into the row. n when v is past the end
+int rowTreeFind(struct rowTree *t, long long v, long long *off) {
+	int pos = 0, step = 1;
+	while (step * 2 <= t->n) step *= 2;
+	for (; step > 0; step /= 2) { 			//descend the tree, skipping whole subtrees that end before v
+		if (pos + step <= t->n && t->sum[pos + step] <= v) {
+			pos += step;
+			v -= t->sum[pos];
+		}
+	}
+	*off = v;
+	return pos;
+}
+
+void rowTreeReserve(struct rowTree *t, int n) {
+	if (n + 1 <= t->cap) return;
+	t->cap = t->cap ? t->cap : 1024;
+	while (t->cap < n + 1) t->cap *= 2;
+	t->sum = realloc(t->sum, sizeof(long long) * t->cap);
+}
+
+//rebuilds a tree from a value of every row in O(n)
+void rowTreeBuild(struct rowTree *t, editorBuffer *b, long long (*value)(erow *)) {
+	rowTreeReserve(t, b->numrows);
+	t->n = b->numrows;
+	for (int i = 1; i <= t->n; i++) t->sum[i] = value(&b->row[i - 1]);
+	for (int i = 1; i <= t->n; i++) {
+		int parent = i + (i & -i);
+		if (parent <= t->n) t->sum[parent] += t->sum[i];
+	}
+	t->stale = 0;
+}
+
+//changes the value of a row in O(log n), a row just past the end is appended. nothing to do before the first build
+void rowTreeSet(struct rowTree *t, int idx, long long value) {
+	if (t->sum == NULL || t->stale) return;
+	if (idx < t->n) {
+		rowTreeAdd(t, idx, value - (rowTreePrefix(t, idx + 1) - rowTreePrefix(t, idx)));
+	} else if (idx == t->n) { 			//its entry sums the subtrees below it
+		rowTreeReserve(t, t->n + 1);
+		int i = ++t->n;
+		t->sum[i] = value + rowTreePrefix(t, i - 1) - rowTreePrefix(t, i - (i & -i));
+	}
+}
+
+long long rowVlines(erow *row) { return row->vlines; }
+long long rowBytes(erow *row) { return row->size + 1 + row->crlf; } 	//the new-line counts, the file offset of a row sums these
+
+/*** soft wrap ***/
+//the render index after the characters of a row that fit in width columns from render index j, at least one is taken if width > 0
+int editorRowFit(erow *row, int j, int width) {
+	if (width <= 0) return j;
+	if (row->plain) return j + width < row->rsize ? j + width : row->rsize;
+	int cols = 0;
+	while (j < row->rsize) {
+		int cp;
+		int n = utf8Decode(&row->render[j], row->rsize - j, &cp);
+		int w = utf8Width(cp);
+		if (cols + w > width && cols > 0) break;
+		cols += w;
+		j += n;
+	}
+	return j;
+}
+
+//screen lines a row takes when wrapped at width columns. works from chars alone, so released rows can be laid out
+//without rebuilding render: a tab is as many spaces as it is in render & wraps like them, one at a time
+int editorRowWrapLines(erow *row, int width) {
+	if (row->size == 0) return 1;
+	if ((row->render && row->plain) || (utf8IsAscii(row->chars, row->size) && memchr(row->chars, '\t', row->size) == NULL))
+		return (row->size + width - 1) / width;
+	int lines = 1, used = 0;
+	struct rowCol pos = {0, 0, 0};
+	while (pos.cx < row->size) {
+		struct rowCol next = pos;
+		editorRowStep(row, &next);
+		int w = next.col - pos.col;
+		if (row->chars[pos.cx] == '\t') {
+			int room = used < width ? width - used : 0;
+			if (w <= room) {
+				used += w;
+			} else { 				//the spaces run over onto the next lines
+				int rest = w - room;
+				int more = (rest + width - 1) / width;
+				lines += more;
+				used = rest - (more - 1) * width;
+			}
+		} else {
+			if (used + w > width && used > 0) { 	//doesn't fit, starts the next line
+				lines++;
+				used = 0;
+			}
+			used += w;
+		}
+		pos = next;
+	}
+	return lines;
+}
+
+//the render index a row's screen line 'line' starts at, same fitting as editorDrawRows so both agree
+int editorRowWrapStart(erow *row, int width, int line) {
+	if (row->plain) return line * width < row->rsize ? line * width : row->rsize;
+	int j = 0;
+	while (line-- > 0 && j < row->rsize) j = editorRowFit(row, j, width);
+	return j;
+}
+
+//which of a row's screen lines render index rx is on & its column there. the end of a row stays on its last line
+void editorRowWrapFind(erow *row, int width, int rx, int *line, int *x) {
+	int j = 0, l = 0;
+	if (row->plain) {
+		l = rx / width;
+		if (l > 0 && l * width >= row->rsize) l = (row->rsize - 1) / width;
+		j = l * width;
+	} else {
+		while (j < row->rsize) {
+			int e = editorRowFit(row, j, width);
+			if (rx < e || e >= row->rsize) break;
+			j = e;
+			l++;
+		}
+	}
+	int cols = 0;
+	while (j < rx) {
+		int cp;
+		j += utf8Decode(&row->render[j], row->rsize - j, &cp);
+		cols += utf8Width(cp);
+	}
+	*line = l;
+	*x = cols;
+}
+
+//lays out a row that changed & updates its count in the tree, called for every row edit while the buffer is laid out
+void editorWrapRow(editorBuffer *b, erow *row) {
+	if (b->wrap_width == 0 || row->chars == NULL) return;
+	row->vlines = editorRowWrapLines(row, b->wrap_width);
+	rowTreeSet(&b->wrap_tree, row->idx, row->vlines);
+}
+
+//keeps the trees of a buffer in step with a row that changed
+void editorIndexRow(editorBuffer *b, erow *row) {
+	editorWrapRow(b, row);
+	rowTreeSet(&b->offsets, row->idx, rowBytes(row));
+}
+
+struct wrapJob {
+	editorBuffer *b;
+	int width;
+};
+
+void editorWrapChunk(void *arg, int k) { 	//rows only read their own chars, so chunks can be laid out on any thread
+	struct wrapJob *job = arg;
+	int from = k * KILO_WRAP_CHUNK;
+	int to = from + KILO_WRAP_CHUNK < job->b->numrows ? from + KILO_WRAP_CHUNK : job->b->numrows;
+	for (int j = from; j < to; j++)
+		job->b->row[j].vlines = editorRowWrapLines(&job->b->row[j], job->width);
+}
+
+//makes sure the rows are laid out for the current screen width & the tree is up to date
+void editorWrapLayout(editorBuffer *b) {
+	int width = E.screencols > 0 ? E.screencols : 1;
+	if (b->wrap_width != width) { 			//every row has to be laid out again, across the pool
+		editorRestoreText(b); 			//evicted rows have nothing to lay out
+		struct wrapJob job = { b, width };
+		editorParallelFor((b->numrows + KILO_WRAP_CHUNK - 1) / KILO_WRAP_CHUNK, editorWrapChunk, &job);
+		b->wrap_width = width;
+		b->wrap_tree.stale = 1;
+	}
+	if (b->wrap_tree.stale || b->wrap_tree.n != b->numrows) rowTreeBuild(&b->wrap_tree, b, rowVlines);
+}
+
+void editorToggleWrap() {
+	editorBuffer *b = E.buf;
+	b->wrap = !b->wrap;
+	b->wrap_off = 0;
+	b->col_off = 0;
+	if (b->wrap) editorWrapLayout(b);
+	editorSetStatusMessage("Soft wrap %s", b->wrap ? "on" : "off");
+}
+
+//PAGE_UP/PAGE_DOWN by screen lines, the cursor lands a screen away from the edge it starts at, like unwrapped
+void editorWrapPage(int key) {
+	editorBuffer *b = E.buf;
+	editorWrapLayout(b);
+	long long top = rowTreePrefix(&b->wrap_tree, b->row_off) + b->wrap_off;
+	long long total = rowTreePrefix(&b->wrap_tree, b->numrows);
+	long long target = (key == PAGE_UP) ? top - E.screenrows : top + 2 * E.screenrows - 1;
+	if (target < 0) target = 0;
+	if (target > total) target = total;
+	long long off;
+	b->cy = rowTreeFind(&b->wrap_tree, target, &off);
+	b->cx = 0;
+	if (b->cy < b->numrows) { 			//the start of the screen line it landed on
+		erow *row = &b->row[b->cy];
+		editorRowEnsureCache(b, row);
+		b->cx = editorRowSeek(row, COL_BY_RX, editorRowWrapStart(row, b->wrap_width, off)).cx;
+	}
+}
+
+/*** undo ***/
+//starts recording a new command, everything pushed until the next one is undone in one go
+void editorUndoBegin(editorBuffer *b) {
+	b->undo.group++;
+	b->undo.typing = 0;
+}
+
+void editorUndoFreeRecs(struct undoRec *rec, int n) {
+	for (int j = 0; j < n; j++) free(rec[j].chars);
+}
+
+void editorUndoFree(editorBuffer *b) {
+	editorUndoFreeRecs(b->undo.rec, b->undo.n);
+	free(b->undo.rec);
+	memset(&b->undo, 0, sizeof(b->undo));
+}
+
+//records a row change, chars becomes the record's. the oldest commands are dropped past KILO_UNDO_BYTES, never the current one
+void editorUndoPush(editorBuffer *b, int kind, int idx, char *chars, int size) {
+	struct undoLog *u = &b->undo;
+	if (u->n == u->cap) {
+		u->cap = u->cap ? u->cap * 2 : 64;
+		u->rec = realloc(u->rec, sizeof(struct undoRec) * u->cap);
+	}
+	struct undoRec *r = &u->rec[u->n++];
+	r->kind = kind;
+	r->group = u->group;
+	r->idx = idx;
+	r->chars = chars;
+	r->size = size;
+	r->cx = b->cx;
+	r->cy = b->cy;
+	u->bytes += size;
+	while (u->bytes > KILO_UNDO_BYTES && u->rec[0].group != u->group) {
+		int k = 0; 					//records of the oldest command
+		while (k < u->n && u->rec[k].group == u->rec[0].group) u->bytes -= u->rec[k++].size;
+		editorUndoFreeRecs(u->rec, k);
+		memmove(u->rec, &u->rec[k], sizeof(struct undoRec) * (u->n - k));
+		u->n -= k;
+	}
+}
+
+//records the text a row has before it is changed
+void editorUndoSaveRow(editorBuffer *b, int idx) {
+	erow *row = &b->row[idx];
+	char *copy = malloc(row->size + 1);
+	memcpy(copy, row->chars, row->size + 1);
+	editorUndoPush(b, UNDO_TEXT, idx, copy, row->size);
+}
+
+//undoes the last command, its records are applied newest first
+void editorUndo() {
+	editorBuffer *b = E.buf;
+	struct undoLog *u = &b->undo;
+	if (u->n == 0) {
+		editorSetStatusMessage("Nothing to undo");
+		return;
+	}
+	if (editorPrepareEdit(b) == -1) return;
+	b->match_len = 0;
+	int group = u->rec[u->n - 1].group;
+	int cx = 0, cy = 0;
+	while (u->n > 0 && u->rec[u->n - 1].group == group) {
+		struct undoRec *r = &u->rec[--u->n];
+		u->bytes -= r->size;
+		if (r->kind == UNDO_TEXT) { 			//the record's text goes back into the row as it is
+			erow *row = &b->row[r->idx];
+			editorRowUnshare(row);
+			free(row->chars);
+			row->chars = r->chars;
+			row->size = r->size;
+			editorUpdateRow(b, row);
+			b->dirty++;
+			b->gen++;
+		} else if (r->kind == UNDO_INSERT) {
+			editorDelRow(b, r->idx);
+		} else {
+			editorInsertRow(b, r->idx, r->chars, r->size);
+			free(r->chars);
+		}
+		cx = r->cx;
+		cy = r->cy;
+	}
+	u->typing = 0;
+	b->cy = cy <= b->numrows ? cy : b->numrows; 		//where the command started
+	b->cx = 0;
+	if (b->cy < b->numrows) b->cx = editorRowSeek(&b->row[b->cy], COL_BY_CX, cx).cx;
+}
+
+/*** editor operations ***/
+//called before the rows change, evicted rows come back & the seek points of a compressed file stop lining up with them
+//returns -1 for a filter view, its rows belong to another buffer & can't be edited
+int editorPrepareEdit(editorBuffer *b) {
+	if (b->source) {
+		editorSetStatusMessage("Filter view is read-only, Enter jumps to the line in its buffer");
+		return -1;
+	}
+	if (b->hex) {
+		editorSetStatusMessage("Hex view is read-only, ^B goes back to the text");
+		return -1;
+	}
+	if (b->loader && b->cy >= b->numrows) 		//a row made past the loaded end would land before the rest of the file
+		editorLoadFinish(b);
+	editorRestoreText(b);
+	editorGzFreeIndex(b);
+	b->partial_line = 0; 				//the edit may have touched the last row, what follows in the file starts a new one
+	return 0;
+}
+
+void editorInsertChar(int c) {
+	editorBuffer *b = E.buf;
+	if (editorPrepareEdit(b) == -1) return;
+	struct undoLog *u = &b->undo;
+	int typing = (u->typing && u->n > 0 && u->rec[u->n - 1].group == u->group && b->cy < b->numrows &&
+			u->rec[u->n - 1].idx == b->cy && b->cx == u->typing_cx); 	//carries on typing, the row is already saved
+	if (!typing) editorUndoBegin(b);
+	if (b->cy == b->numrows) { 			//if the cursor is at the end of the file
+		editorUndoPush(b, UNDO_INSERT, b->numrows, NULL, 0);
+		editorInsertRow(b, b->numrows, "",0); 			//append a blank row
+	}
+	if (!typing) editorUndoSaveRow(b, b->cy);
+	editorRowInsertChar(b, &b->row[b->cy], b->cx, c); 	//insert the character into the row, and column, marked by the cursor
+	b->cx++; 					//increment the column cursor after inserting the character
+	u->typing = 1;
+	u->typing_cx = b->cx;
+}
+
+void editorInsertNewLine() {
+	editorBuffer *b = E.buf;
+	if (editorPrepareEdit(b) == -1) return;
+	editorUndoBegin(b);
+	if (b->cx == 0) { 							//if we are at the beginning of the line
+		editorUndoPush(b, UNDO_INSERT, b->cy, NULL, 0);
+		editorInsertRow(b, b->cy, "",0); 					//just insert a row
+	} else { 								//if we are within a line
+		editorUndoSaveRow(b, b->cy);
+		editorUndoPush(b, UNDO_INSERT, b->cy + 1, NULL, 0);
+		erow *row = &b->row[b->cy]; 					//get the rows address
+		editorInsertRow(b, b->cy + 1, &row->chars[b->cx], row->size - b->cx); 	//split the current line and move the string to the right of the cursor to the new-line
+		row = &b->row[b->cy]; 						//row pointer could have been reassigned in editorInsertRow
+		row->size = b->cx; 						//update the row-size to the cursor position
+		row->chars[row->size] = '\0'; 					//add a nullbyte
+		editorUpdateRow(b, row);
+	}
+	b->cy++;
+	b->cx = 0;
+}
+
+void editorDelChar() {
+	editorBuffer *b = E.buf;
+	if (editorPrepareEdit(b) == -1) return;
+	if (b->cy == b->numrows) return; 			//if the cursor is at the end of the file, we cannot delete anything
+	if (b->cx == 0 && b->cy == 0) return; 			//nothing before the start of the file
+	editorUndoBegin(b);
+	erow *row = &b->row[b->cy];
+	if (b->cx > 0) {
+		editorUndoSaveRow(b, b->cy);
+		int prev = editorRowPrevChar(row, b->cx); 	//a character can be several bytes
+		editorRowDelChar(b, row, prev, b->cx - prev); 	//delete the character in the current row at the current column
+		b->cx = prev; 					//move the column cursor back over the deleted character
+	} else {
+		editorUndoSaveRow(b, b->cy - 1);
+		char *copy = malloc(row->size + 1); 		//the row is about to be freed, undo puts it back
+		memcpy(copy, row->chars, row->size + 1);
+		editorUndoPush(b, UNDO_DELETE, b->cy, copy, row->size);
+		b->cx = b->row[b->cy - 1].size;
+		editorRowAppendString(b, &b->row[b->cy-1], row->chars, row->size);
+		editorDelRow(b, b->cy);
+		b->cy--;
+	}
+}
+
+/*** file I/O ***/
+//splits a chunk of file data into rows appended to the end of the buffer
+//a line left unterminated at the end of the chunk is continued by the next chunk
+void editorIngest(editorBuffer *b, const char *data, size_t len) {
+	unsigned long gen = b->gen;
+	const char *p = data;
+	const char *end = data + len;
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p); 	//end of the current line, NULL if it continues past the chunk
+		size_t linelen = (nl ? nl : end) - p;
+		if (b->partial_line && b->numrows > 0) { 	//finish the line the previous chunk started
+			erow *row = &b->row[b->numrows - 1];
+			editorRowAppendString(b, row, p, linelen);
+			if (nl && row->size > 0 && row->chars[row->size - 1] == '\r') { 	//the \r could have come from either chunk
+				row->chars[--row->size] = '\0';
+				row->crlf = 1;
+				editorUpdateRow(b, row);
+			}
+			gen = b->gen; 				//the row grew, views of it have to look again
+		} else {
+			int crlf = (nl && linelen > 0 && p[linelen - 1] == '\r');
+			editorInsertRow(b, b->numrows, p, linelen - crlf);
+			if (crlf) {
+				b->row[b->numrows - 1].crlf = 1;
+				editorIndexRow(b, &b->row[b->numrows - 1]); 	//its offset counts the \r
+			}
+			b->gen = gen; 				//a row at the end leaves the others alone, views just scan it
+		}
+		b->partial_line = (nl == NULL);
+		p = nl ? nl + 1 : end;
+	}
+	b->file_bytes += len;
+}
+
+char *editorRowsToString(editorBuffer *b, int *buflen) {
+	editorRestoreText(b);
+	int totlen = 0; 					//sum of the length of all rows + a new-line character for each
+	int j; 							//iterator
+	for (j = 0; j < b->numrows; j++) 			//for-each row
+		totlen += b->row[j].size + 1; 			//add a row & its new-line to the total
+	*buflen = totlen; 					//set the buffer length
+
+	char *buf = malloc(totlen); 				//allocate a buffer to hold all the rows
+	char *p = buf; 						//pointer to end of buffer
+	for (j=0; j< b->numrows; j++) { 				//for-each row in rows
+		memcpy(p, b->row[j].chars, b->row[j].size); 	//copy the current row into the end of the buffer
+		p += b->row[j].size; 				//move the pointer to the end of the buffer
+		*p = '\n'; 					//add a new-line character
+		p++; 						//move pointer to end of buffer again
+	}
+	return buf; 						//expect the caller to free memory
+}
+
+//starts reading a file into a buffer, the rows arrive in the background. returns -1 if the file could not be opened
+int editorOpen(editorBuffer *b, char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) return -1;
+
+	unsigned char magic[4]; 				//the first bytes tell us if the file is compressed
+	ssize_t nmagic = pread(fd, magic, sizeof(magic), 0);
+	if (nmagic == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+		close(fd); 					//zstd, we are only built against zlib
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	free(b->filename);
+	b->filename = strdup(filename);
+
+	editorSelectSyntaxHighlight(b);
+
+	int compressed = (nmagic >= 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+	char sniff[KILO_HEX_SNIFF];
+	ssize_t nsniff = compressed ? 0 : pread(fd, sniff, sizeof(sniff), 0);
+	if (nsniff > 0 && memchr(sniff, '\0', nsniff)) { 	//binary, splitting it on new-lines makes no sense
+		int err = editorHexMap(b, fd);
+		close(fd); 					//the mapping stays valid without it
+		return err;
+	}
+	editorLoad(b, fd, compressed); 			//the loader thread owns fd from here
+	return 0;
+}
+
+void editorSave() {
+	editorBuffer *b = E.buf;
+	if (b->hex) { 						//the rows may not even be read, saving them would truncate the file
+		editorSetStatusMessage("Hex view is read-only, ^B goes back to the text");
+		return;
+	}
+	if (b->filename == NULL) { 				//no file to save to
+		b->filename = editorPrompt("Save as %s", NULL); 	//prompt for a file-name
+		if (b->filename == NULL) {
+			editorSetStatusMessage("Save aborted");
+			return;
+		}
+		editorSelectSyntaxHighlight(b);
+	}
+
+	editorLoadFinish(b); 					//saving half a file would truncate it
+	int len; 						//the length of the buffer
+	char *buf = editorRowsToString(b, &len); 			//pointer to the buffer
+	for (int j = 0; j < b->numrows; j++) { 			//every line is written with a plain new-line
+		if (!b->row[j].crlf) continue;
+		b->row[j].crlf = 0;
+		b->offsets.stale = 1;
+	}
+
+	if (b->compressed) { 					//compressing takes a while, a thread does it & frees buf
+		editorSaveGz(b, buf, len);
+		return;
+	}
+
+	int fd = open(b->filename, O_RDWR | O_CREAT, 0644); 	//open for RW / create, a file with chmod 0644 
+	if (fd != -1) {
+		if(ftruncate(fd,len) != -1) { 			//sets the file-size to a specific length. Helps with data-loss prevention?
+			if (write(fd,buf,len) == len) { 	//write the buffer of length to the file
+				close(fd); 			//close the file
+				free(buf); 			//free the buffer
+				editorSetStatusMessage("%d bytes written to disk", len);
+				b->dirty = 0;
+				b->file_bytes = len; 		//every row was written with its new-line
+				b->partial_line = 0;
+				return;
+			}
+		}
+		close(fd);
+	}
+	free(buf);
+	editorSetStatusMessage("Failed to save. I/O Error: %s", strerror(errno));
+}
+
+/*** compressed files ***/
+//a compressed save running on its own thread, reaped by editorProcessEvents once done
+struct saveJob {
+	pthread_t thread;
+	editorBuffer *b; 			//the buffer to mark modified again if the save fails, NULL once it is closed
+	char *filename;
+	char *buf; 				//the rows, as editorRowsToString made them
+	int len;
+	int done; 				//flag, set by the thread under E.save_lock
+	int err; 				//errno of the failure, 0 on success
+	struct saveJob *next;
+};
+
+//adds a seek point at the current position of strm, which has to be at the end of a deflate block
+void gzAddPoint(struct gzIndex *idx, z_stream *strm, off_t in, off_t out, int line, int midline) {
+	if (idx->have == idx->size) {
+		idx->size = idx->size ? idx->size * 2 : 8;
+		idx->list = realloc(idx->list, sizeof(struct gzPoint) * idx->size);
+	}
+	struct gzPoint *p = &idx->list[idx->have++];
+	p->out = out;
+	p->in = in;
+	p->bits = strm->data_type & 7; 				//unused bits in the last byte read
+	p->line = line;
+	p->midline = midline;
+	p->window = malloc(KILO_GZ_WINSIZE);
+	uInt winlen = KILO_GZ_WINSIZE;
+	inflateGetDictionary(strm, p->window, &winlen); 	//shorter than the full window near the start of the stream
+	p->winlen = winlen;
+}
+
+void gzIndexFree(struct gzIndex *idx) {
+	if (idx == NULL) return;
+	for (int j = 0; j < idx->have; j++)
+		free(idx->list[j].window);
+	free(idx->list);
+	free(idx);
+}
+
+void editorGzFreeIndex(editorBuffer *b) {
+	gzIndexFree(b->gz);
+	b->gz = NULL;
+}
+
+//puts the inflated text of an evicted row back
+void editorGzSetRow(editorBuffer *b, int at, const char *s, size_t len) {
+	erow *row = &b->row[at];
+	if (row->chars != NULL) return; 			//never evicted, or already restored
+	if (row->crlf && len > 0 && s[len - 1] == '\r') len--; 	//a lone \r at the end of the file is text, the loader kept it too
+	row->chars = malloc(len + 1);
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	row->size = len;
+	editorUpdateRow(b, row);
+}
+
+//inflates the rows between the seek point before row 'at' & the next seek point, nothing before it is touched
+void editorGzRestore(editorBuffer *b, int at) {
+	struct gzIndex *idx = b->gz;
+	int lo = 0, hi = idx->have - 1; 			//binary search for the last point whose first row is at or before 'at'
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (idx->list[mid].line <= at) lo = mid;
+		else hi = mid - 1;
+	}
+	struct gzPoint *p = &idx->list[lo];
+	int end = (lo + 1 < idx->have) ? idx->list[lo + 1].line : b->numrows; 	//the rows that start before the next point
+
+	int fd = open(b->filename, O_RDONLY);
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	inflateInit2(&strm, -15); 				//raw deflate, we start in the middle of the stream
+	unsigned char *in = malloc(KILO_GZ_CHUNK);
+	unsigned char *out = malloc(KILO_GZ_CHUNK);
+	off_t pos = p->in;
+	if (p->bits) { 						//the point starts part-way into a byte
+		unsigned char c = 0;
+		if (pread(fd, &c, 1, pos - 1) == 1)
+			inflatePrime(&strm, p->bits, c >> (8 - p->bits));
+	}
+	inflateSetDictionary(&strm, p->window, p->winlen);
+
+	char *line = NULL; 					//the current line, it can span many chunks
+	size_t linelen = 0, linecap = 0;
+	int row = p->line;
+	int skip = p->midline; 					//the first bytes finish a line that belongs to the previous point
+	int trailer = 0; 					//bytes of a gzip member trailer still to be skipped
+	int more_out = 0;
+	while (row < end && fd != -1) {
+		if (strm.avail_in == 0 && !more_out) {
+			ssize_t nread = pread(fd, in, KILO_GZ_CHUNK, pos);
+			if (nread <= 0) break;
+			pos += nread;
+			strm.next_in = in;
+			strm.avail_in = nread;
+		}
+		if (trailer) { 					//the crc & length of the member before the next header
+			unsigned int n = strm.avail_in < (unsigned int)trailer ? strm.avail_in : (unsigned int)trailer;
+			strm.next_in += n;
+			strm.avail_in -= n;
+			trailer -= n;
+			continue;
+		}
+		strm.next_out = out;
+		strm.avail_out = KILO_GZ_CHUNK;
+		int ret = inflate(&strm, Z_NO_FLUSH);
+		more_out = (strm.avail_out == 0);
+		unsigned char *q = out;
+		unsigned char *qend = out + (KILO_GZ_CHUNK - strm.avail_out);
+		while (q < qend && row < end) {
+			unsigned char *nl = memchr(q, '\n', qend - q);
+			size_t n = (nl ? nl : qend) - q;
+			if (!skip) {
+				if (linelen + n > linecap) {
+					linecap = (linelen + n) * 2;
+					line = realloc(line, linecap);
+				}
+				memcpy(line + linelen, q, n);
+				linelen += n;
+			}
+			if (nl) {
+				if (skip) skip = 0;
+				else editorGzSetRow(b, row++, line, linelen);
+				linelen = 0;
+			}
+			q = nl ? nl + 1 : qend;
+		}
+		if (ret == Z_STREAM_END) { 			//the next member has a header of its own
+			inflateReset2(&strm, 31);
+			trailer = 8;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			break;
+		}
+	}
+	if (row < end && !skip && linelen > 0) 			//the file ended without a new-line
+		editorGzSetRow(b, row++, line, linelen);
+	for (; row < end; row++) 				//the file changed under us, leave the rows empty instead of dangling
+		editorGzSetRow(b, row, "", 0);
+	if (at >= end) editorGzSetRow(b, at, "", 0); 		//not reachable with a sane index, but never leave the row evicted
+
+	inflateEnd(&strm);
+	free(line);
+	free(in);
+	free(out);
+	if (fd != -1) close(fd);
+}
+
+void *editorSaveGzThread(void *arg) {
+	struct saveJob *job = arg;
+	char *tmp = malloc(strlen(job->filename) + 8); 	//written next to the file & renamed over it, never half a file
+	sprintf(tmp, "%s.XXXXXX", job->filename);
+	int err = 0;
+	int fd = mkstemp(tmp); 				//a name of its own, whatever else is saving next to it
+	gzFile gz = NULL;
+	if (fd != -1) {
+		struct stat st;
+		fchmod(fd, stat(job->filename, &st) == 0 ? (st.st_mode & 07777) : 0644); 	//mkstemp makes it 0600
+		gz = gzdopen(fd, "wb");
+		if (gz == NULL) close(fd);
+	}
+	if (gz == NULL) {
+		err = errno ? errno : ENOMEM;
+		if (fd != -1) unlink(tmp);
+	} else {
+		if (job->len && gzwrite(gz, job->buf, job->len) != job->len) err = EIO;
+		if (gzclose(gz) != Z_OK && !err) err = EIO;
+		if (!err && rename(tmp, job->filename) == -1) err = errno;
+		if (err) unlink(tmp);
+	}
+	free(tmp);
+	pthread_mutex_lock(&E.save_lock);
+	job->err = err;
+	job->done = 1;
+	pthread_mutex_unlock(&E.save_lock);
+	editorWake();
+	return NULL;
+}
+
+//hands the rows of a compressed buffer to a thread that compresses them to disk
+void editorSaveGz(editorBuffer *b, char *buf, int len) {
+	editorReapSavesOf(b->filename, 1); 			//an older save of the file finishing last would win the rename
+	struct saveJob *job = calloc(1, sizeof(struct saveJob));
+	job->b = b;
+	job->filename = strdup(b->filename);
+	job->buf = buf;
+	job->len = len;
+	if (editorThreadCreate(&job->thread, editorSaveGzThread, job) != 0) {
+		editorSetStatusMessage("Failed to save. Can't start a thread: %s", strerror(errno));
+		free(job->filename);
+		free(job);
+		free(buf);
+		return;
+	}
+	job->next = E.saves;
+	E.saves = job;
+	editorGzFreeIndex(b); 					//the seek points describe the old file
+	b->dirty = 0;
+	editorSetStatusMessage("Compressing %d bytes to disk...", len);
+}
+
+//collects finished compressed saves of a file (NULL = every file), or waits for them. returns 1 if any finished
+int editorReapSavesOf(const char *filename, int wait) {
+	int reaped = 0;
+	struct saveJob **pp = &E.saves;
+	while (*pp) {
+		struct saveJob *job = *pp;
+		if (filename && strcmp(job->filename, filename)) {
+			pp = &job->next;
+			continue;
+		}
+		pthread_mutex_lock(&E.save_lock);
+		int done = job->done;
+		pthread_mutex_unlock(&E.save_lock);
+		if (!done && !wait) {
+			pp = &job->next;
+			continue;
+		}
+		pthread_join(job->thread, NULL);
+		if (job->err) {
+			editorSetStatusMessage("Failed to save %s. I/O Error: %s", job->filename, strerror(job->err));
+			if (job->b) job->b->dirty++; 		//the buffer is no longer saved, if it is still open
+		} else {
+			editorSetStatusMessage("%d bytes compressed & written to disk", job->len);
+		}
+		*pp = job->next;
+		free(job->filename);
+		free(job->buf);
+		free(job);
+		reaped = 1;
+	}
+	return reaped;
+}
+
+//collects finished compressed saves, or waits for all of them. returns 1 if any finished
+int editorReapSaves(int wait) {
+	return editorReapSavesOf(NULL, wait);
+}
+
+/*** loader ***/
+//rows made by the loader thread, waiting for the main loop to append them
+struct loadBatch {
+	erow *rows; 				//chars & render are filled in, the rest is up to the main loop
+	int numrows;
+	int cap;
+	struct loadBatch *next;
+};
+//reads a file on its own thread, the main loop appends what it has so far on every event tick
+struct editorLoader {
+	pthread_t thread;
+	int fd;
+	int compressed; 			//flag, inflate what we read & build the seek points
+	off_t size; 				//size of the file on disk, for the progress indicator
+	pthread_mutex_t lock; 			//guards everything down to err
+	pthread_cond_t cond; 			//signalled whenever a batch is queued or the thread is done
+	struct loadBatch *head, *tail; 		//queue of batches not appended yet
+	off_t read_bytes; 			//bytes of the file read so far
+	int done; 				//flag, the last batch is queued & the fields below are final
+	int cancel; 				//flag, the buffer was closed, stop reading
+	int err; 				//errno of a read error, EILSEQ if the compressed data is corrupt
+	struct gzIndex *gz; 			//seek points, handed to the buffer when done
+	off_t out_bytes; 			//bytes of (uncompressed) text read, the buffer's file_bytes
+	int partial_line; 			//flag, the last row had no new-line
+	//only touched by the thread
+	char *carry; 				//the start of a line the last chunk didn't finish
+	size_t carrylen, carrycap;
+	int rows; 				//rows made so far, seek points refer to them
+	struct loadBatch *cur; 			//batch being filled
+};
+
+//nl is set when a new-line ended the line, only then is a \r before it part of a CRLF
+void loaderAddRow(struct editorLoader *ld, const char *s, size_t len, int nl) {
+	struct loadBatch *bt = ld->cur;
+	if (bt == NULL) bt = ld->cur = calloc(1, sizeof(struct loadBatch));
+	if (bt->numrows == bt->cap) {
+		bt->cap = bt->cap ? bt->cap * 2 : 1024;
+		bt->rows = realloc(bt->rows, sizeof(erow) * bt->cap);
+	}
+	int crlf = (nl && len > 0 && s[len - 1] == '\r');
+	len -= crlf;
+	erow *row = &bt->rows[bt->numrows++];
+	memset(row, 0, sizeof(erow));
+	row->crlf = crlf;
+	row->size = len;
+	row->chars = malloc(len + 1);
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	editorRowRender(row);
+	ld->rows++;
+}
+
+//splits file data into rows, a line left unterminated at the end waits in carry for the next chunk
+void loaderSplit(struct editorLoader *ld, const char *data, size_t len) {
+	const char *p = data;
+	const char *end = data + len;
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		size_t n = (nl ? nl : end) - p;
+		if (nl && ld->carrylen == 0) { 		//the whole line is in this chunk, no copy needed
+			loaderAddRow(ld, p, n, 1);
+		} else {
+			if (ld->carrylen + n > ld->carrycap) {
+				ld->carrycap = (ld->carrylen + n) * 2;
+				ld->carry = realloc(ld->carry, ld->carrycap);
+			}
+			memcpy(ld->carry + ld->carrylen, p, n);
+			ld->carrylen += n;
+			if (nl) {
+				loaderAddRow(ld, ld->carry, ld->carrylen, 1);
+				ld->carrylen = 0;
+			}
+		}
+		p = nl ? nl + 1 : end;
+	}
+}
+
+//queues the batch being filled for the main loop, returns 1 if the buffer was closed in the meantime
+int loaderPublish(struct editorLoader *ld, off_t read_bytes, int done) {
+	pthread_mutex_lock(&ld->lock);
+	if (ld->cur) {
+		if (ld->tail) ld->tail->next = ld->cur;
+		else ld->head = ld->cur;
+		ld->tail = ld->cur;
+		ld->cur = NULL;
+	}
+	ld->read_bytes = read_bytes;
+	ld->done = done;
+	int cancel = ld->cancel;
+	pthread_cond_broadcast(&ld->cond);
+	pthread_mutex_unlock(&ld->lock);
+	editorWake();
+	return cancel;
+}
+
+void *editorLoaderThread(void *arg) {
+	struct editorLoader *ld = arg;
+	unsigned char *in = malloc(KILO_LOAD_CHUNK);
+	unsigned char *out = NULL;
+	z_stream strm;
+	struct gzIndex *idx = NULL;
+	off_t read_bytes = 0; 					//bytes read from the file
+	off_t totin = 0; 					//compressed bytes used up by inflate
+	off_t totout = 0; 					//bytes of text produced
+	off_t last = 0; 					//totout at the last seek point
+	int ended = 0; 						//the last gzip member ended properly
+	int err = 0;
+	if (ld->compressed) {
+		memset(&strm, 0, sizeof(strm));
+		inflateInit2(&strm, 47); 			//47 = the largest window, expecting a gzip header
+		out = malloc(KILO_GZ_CHUNK);
+		idx = calloc(1, sizeof(struct gzIndex));
+	}
+	while (1) {
+		ssize_t nread = read(ld->fd, in, KILO_LOAD_CHUNK);
+		if (nread == -1 && errno == EINTR) continue;
+		if (nread <= 0) {
+			if (nread == -1) err = errno;
+			break;
+		}
+		read_bytes += nread;
+		if (!ld->compressed) {
+			loaderSplit(ld, (char *)in, nread);
+			totout += nread;
+		} else {
+			strm.next_in = in;
+			strm.avail_in = nread;
+			int more_out; 				//inflate filled the output, it may have more without new input
+			do {
+				unsigned int avail = strm.avail_in;
+				strm.next_out = out;
+				strm.avail_out = KILO_GZ_CHUNK;
+				int ret = inflate(&strm, Z_BLOCK); 	//Z_BLOCK returns at the end of every deflate block, where seek points can go
+				totin += avail - strm.avail_in;
+				size_t produced = KILO_GZ_CHUNK - strm.avail_out;
+				totout += produced;
+				more_out = (strm.avail_out == 0);
+				if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+					err = EILSEQ;
+					break;
+				}
+				if (produced) {
+					loaderSplit(ld, (char *)out, produced);
+					ended = 0;
+				}
+				if (ret == Z_STREAM_END) { 	//another gzip member may follow, it starts with its own header
+					inflateReset(&strm);
+					ended = 1;
+				} else if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+						(totout == 0 || totout - last >= KILO_GZ_SPAN)) { 	//at a block boundary, that isn't the last block
+					int midline = ld->carrylen > 0; 	//the row in carry started before this point
+					gzAddPoint(idx, &strm, totin, totout, ld->rows + midline, midline);
+					last = totout;
+				}
+			} while (strm.avail_in > 0 || more_out);
+			if (err) break;
+		}
+		if (loaderPublish(ld, read_bytes, 0)) break;
+	}
+	int partial_line = 0;
+	if (ld->carrylen > 0) { 				//the file ended without a new-line
+		loaderAddRow(ld, ld->carry, ld->carrylen, 0);
+		partial_line = 1;
+	}
+	if (ld->compressed) {
+		if (!err && !ended && totout > 0) err = EILSEQ;
+		inflateEnd(&strm);
+	}
+	free(in);
+	free(out);
+	free(ld->carry);
+	ld->gz = idx; 						//published by the lock in loaderPublish
+	ld->out_bytes = totout;
+	ld->partial_line = partial_line;
+	ld->err = err;
+	loaderPublish(ld, read_bytes, 1);
+	return NULL;
+}
+
+//hands the file to a loader thread, rows show up in the buffer as editorProcessEvents appends them
+void editorLoad(editorBuffer *b, int fd, int compressed) {
+	struct editorLoader *ld = calloc(1, sizeof(struct editorLoader));
+	ld->fd = fd;
+	ld->compressed = compressed;
+	struct stat st;
+	if (fstat(fd, &st) == 0) ld->size = st.st_size;
+	pthread_mutex_init(&ld->lock, NULL);
+	pthread_cond_init(&ld->cond, NULL);
+	b->loader = ld;
+	b->load_percent = 0;
+	if (editorThreadCreate(&ld->thread, editorLoaderThread, ld) != 0) die("pthread_create");
+}
+
+//appends rows made by the loader, chars & render are done so only the highlighting is left
+void editorAppendRows(editorBuffer *b, erow *rows, int n) {
+	int first = b->numrows;
+	for (int j = 0; j < n; j++) {
+		editorGrowRows(b);
+		erow *row = &b->row[b->numrows];
+		*row = rows[j];
+		row->idx = b->numrows;
+		row->hl_open_comment = 0;
+		b->cache_bytes += editorRowCacheSize(row); 	//just render, the spans are counted as they are made
+		b->numrows++;
+		editorIndexRow(b, row); 			//rows at the end go straight onto the trees
+	}
+	editorHighlightRows(b, first, b->numrows);
+}
+
+void editorLoaderFree(struct editorLoader *ld) {
+	pthread_join(ld->thread, NULL);
+	while (ld->head) { 					//batches that never made it into the buffer
+		struct loadBatch *bt = ld->head;
+		ld->head = bt->next;
+		for (int j = 0; j < bt->numrows; j++) {
+			editorRowDropRender(&bt->rows[j]);
+			free(bt->rows[j].chars);
+		}
+		free(bt->rows);
+		free(bt);
+	}
+	gzIndexFree(ld->gz);
+	close(ld->fd);
+	pthread_mutex_destroy(&ld->lock);
+	pthread_cond_destroy(&ld->cond);
+	free(ld);
+}
+
+//appends the rows the loader has made so far, for at most budget_ms (0 = no limit). returns 1 if anything changed
+int editorLoaderDrain(editorBuffer *b, int budget_ms) {
+	struct editorLoader *ld = b->loader;
+	if (ld == NULL) return 0;
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int dirty = b->dirty; 					//loaded rows come from the file, they don't modify it
+	int changed = 0;
+	while (1) {
+		pthread_mutex_lock(&ld->lock);
+		struct loadBatch *bt = ld->head;
+		if (bt) {
+			ld->head = bt->next;
+			if (ld->head == NULL) ld->tail = NULL;
+		}
+		int done = ld->done;
+		off_t read_bytes = ld->read_bytes;
+		pthread_mutex_unlock(&ld->lock);
+
+		int percent = ld->size ? (int)(read_bytes * 100 / ld->size) : 100;
+		if (percent != b->load_percent) changed = 1;
+		b->load_percent = percent;
+		if (bt == NULL) {
+			if (!done) break;
+			//every row is in, the buffer takes over what the loader found out about the file
+			b->file_bytes = ld->out_bytes;
+			b->partial_line = ld->partial_line;
+			if (ld->compressed) {
+				b->compressed = 1;
+				if (dirty == 0) { 		//edited while loading, the seek points no longer line up
+					b->gz = ld->gz;
+					ld->gz = NULL;
+				}
+			}
+			if (ld->err)
+				editorSetStatusMessage("%s: %s", b->filename,
+						ld->err == EILSEQ ? "compressed data is corrupt or truncated" : strerror(ld->err));
+			editorLoaderFree(ld);
+			b->loader = NULL;
+			b->dirty = dirty;
+			if (b->follow_on_load) {
+				b->follow_on_load = 0;
+				editorFollow(b, 1);
+			}
+			editorTrimCaches();
+			return 1;
+		}
+		editorAppendRows(b, bt->rows, bt->numrows);
+		free(bt->rows);
+		free(bt);
+		changed = 1;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (budget_ms && (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 >= budget_ms) {
+			editorWake(); 				//there may be more queued, come back right after the keyboard
+			break;
+		}
+	}
+	b->dirty = dirty;
+	return changed;
+}
+
+//blocks until the whole file is in the buffer
+void editorLoadFinish(editorBuffer *b) {
+	while (b->loader) {
+		struct editorLoader *ld = b->loader;
+		pthread_mutex_lock(&ld->lock);
+		while (ld->head == NULL && !ld->done)
+			pthread_cond_wait(&ld->cond, &ld->lock);
+		pthread_mutex_unlock(&ld->lock);
+		editorLoaderDrain(b, 0);
+	}
+}
+
+//stops the loader of a buffer that is being closed
+void editorLoadCancel(editorBuffer *b) {
+	if (b->loader == NULL) return;
+	pthread_mutex_lock(&b->loader->lock);
+	b->loader->cancel = 1;
+	pthread_mutex_unlock(&b->loader->lock);
+	editorLoaderFree(b->loader);
+	b->loader = NULL;
+}
+
+/*** buffers ***/
+//creates an empty buffer at the end of the buffer list
+editorBuffer *editorNewBuffer() {
+	editorBuffer *b = calloc(1, sizeof(editorBuffer)); 	//zeroed, so the cursor starts at 0,0 & there are no rows
+	E.bufs = realloc(E.bufs, sizeof(editorBuffer *) * (E.numbufs + 1));
+	E.bufs[E.numbufs++] = b;
+	return b;
+}
+
+void editorFreeBuffer(editorBuffer *b) {
+	for (struct saveJob *job = E.saves; job; job = job->next) 	//a save still running forgets the buffer
+		if (job->b == b) job->b = NULL;
+	editorLoadCancel(b);
+	editorFollow(b, 0);
+	editorFilterDetach(b); 				//views can't keep pointing at rows that are about to go
+	for (int j = 0; j < b->numrows; j++)
+		editorFreeRow(b, &b->row[j]);
+	free(b->row);
+	editorUndoFree(b);
+	free(b->wrap_tree.sum);
+	free(b->offsets.sum);
+	free(b->filename);
+	free(b->filter);
+	free(b->line_map);
+	editorHexUnmap(b);
+	free(b);
+}
+
+int editorAnyDirty() {
+	for (int j = 0; j < E.numbufs; j++)
+		if (E.bufs[j]->dirty) return 1;
+	return 0;
+}
+
+//releases the caches of hidden buffers, least recently used first, until we are back under KILO_CACHE_BUDGET
+void editorTrimCaches() {
+	size_t total = 0;
+	for (int j = 0; j < E.numbufs; j++)
+		total += E.bufs[j]->cache_bytes;
+	while (total > KILO_CACHE_BUDGET) {
+		editorBuffer *coldest = NULL;
+		for (int j = 0; j < E.numbufs; j++) { 		//the active buffer is never released
+			editorBuffer *b = E.bufs[j];
+			if (b == E.buf || b->cache_bytes == 0) continue;
+			if (coldest == NULL || b->last_used < coldest->last_used) coldest = b;
+		}
+		if (coldest == NULL) break; 			//only the active buffer is left holding caches
+		total -= coldest->cache_bytes;
+		editorReleaseCaches(coldest);
+	}
+}
+
+void editorSwitchBuffer(int idx) {
+	if (idx < 0 || idx >= E.numbufs) return;
+	E.curbuf = idx;
+	E.buf = E.bufs[idx];
+	E.buf->last_used = ++E.tick;
+	editorTrimCaches(); 				//the buffer we left is now a candidate for release
+}
+
+//prompts for a file & opens it in a new buffer, or switches to it if it is already open
+void editorOpenBuffer() {
+	char *filename = editorPrompt("Open: %s (ESC to cancel)", NULL);
+	if (filename == NULL) return;
+	for (int j = 0; j < E.numbufs; j++) {
+		if (E.bufs[j]->filename && !strcmp(E.bufs[j]->filename, filename)) {
+			editorSwitchBuffer(j);
+			free(filename);
+			return;
+		}
+	}
+	editorBuffer *b = editorNewBuffer();
+	if (editorOpen(b, filename) == -1) {
+		editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+		E.numbufs--; 					//it is the last buffer in the list
+		editorFreeBuffer(b);
+	} else {
+		editorSwitchBuffer(E.numbufs - 1);
+	}
+	free(filename);
+}
+
+//closes the active buffer, there is always at least one buffer open
+void editorCloseBuffer() {
+	editorFreeBuffer(E.buf);
+	memmove(&E.bufs[E.curbuf], &E.bufs[E.curbuf + 1], sizeof(editorBuffer *) * (E.numbufs - E.curbuf - 1));
+	E.numbufs--;
+	if (E.numbufs == 0) editorNewBuffer();
+	editorSwitchBuffer(E.curbuf < E.numbufs ? E.curbuf : E.numbufs - 1);
+}
+
+/*** filter ***/
+//a filter view is a buffer of the rows of another buffer that match a pattern. its rows borrow chars from the source,
+//nothing is copied, & line_map takes each one back to where it came from
+
+struct filterChunk { 				//the matches one job found, in row order
+	erow *rows;
+	int *map;
+	int n, cap;
+};
+
+struct filterJob {
+	editorBuffer *src;
+	int from; 					//first source row to scan
+	const char *pat;
+	int regex; 					//flag, pat is an extended regex, else a literal
+	struct filterChunk *out; 			//one per job
+};
+
+//the number of filter views that point at the rows of a buffer
+int editorFilterViews(editorBuffer *b) {
+	int n = 0;
+	for (int j = 0; j < E.numbufs; j++)
+		if (E.bufs[j]->source == b) n++;
+	return n;
+}
+
+//splits what was typed into the pattern & whether it is a regex, /like this/. the pattern is malloc'd
+char *editorFilterPattern(const char *filter, int *regex) {
+	size_t len = strlen(filter);
+	*regex = (len >= 2 && filter[0] == '/' && filter[len - 1] == '/');
+	return *regex ? strndup(filter + 1, len - 2) : strdup(filter);
+}
+
+//matches the source rows of one job. the rows are only read, so every chunk can run on its own thread
+void editorFilterChunk(void *arg, int k) {
+	struct filterJob *job = arg;
+	struct filterChunk *out = &job->out[k];
+	int from = job->from + k * KILO_FILTER_CHUNK;
+	int to = from + KILO_FILTER_CHUNK < job->src->numrows ? from + KILO_FILTER_CHUNK : job->src->numrows;
+	regex_t re; 					//a compiled regex takes a lock in regexec, so each job has its own
+	if (job->regex && regcomp(&re, job->pat, REG_EXTENDED | REG_NOSUB) != 0) return; 	//checked before the scan
+	size_t plen = strlen(job->pat);
+	for (int j = from; j < to; j++) {
+		erow *src = &job->src->row[j];
+		int hit = job->regex ? regexec(&re, src->chars, 0, NULL, 0) == 0 :
+				memmem(src->chars, src->size, job->pat, plen) != NULL;
+		if (!hit) continue;
+		if (out->n == out->cap) {
+			out->cap = out->cap ? out->cap * 2 : 64;
+			out->rows = realloc(out->rows, sizeof(erow) * out->cap);
+			out->map = realloc(out->map, sizeof(int) * out->cap);
+		}
+		erow *row = &out->rows[out->n];
+		memset(row, 0, sizeof(erow));
+		row->chars = src->chars; 		//borrowed, the text stays where it is
+		row->size = src->size;
+		editorRowRender(row); 			//render is chars too, unless there are tabs
+		out->map[out->n++] = j;
+	}
+	if (job->regex) regfree(&re);
+}
+
+//appends the matches among the source rows from 'from' on to a view, the scan is spread over the pool
+void editorFilterScan(editorBuffer *b, int from) {
+	editorBuffer *src = b->source;
+	editorRestoreText(src); 			//evicted rows have nothing to match, they stay put from now on
+	b->source_gen = src->gen;
+	b->source_rows = src->numrows;
+	if (from >= src->numrows) return;
+	int regex;
+	char *pat = editorFilterPattern(b->filter, &regex);
+	int chunks = (src->numrows - from + KILO_FILTER_CHUNK - 1) / KILO_FILTER_CHUNK;
+	struct filterChunk *out = calloc(chunks, sizeof(struct filterChunk));
+	struct filterJob job = { src, from, pat, regex, out };
+	editorParallelFor(chunks, editorFilterChunk, &job);
+
+	int n = 0;
+	for (int k = 0; k < chunks; k++) n += out[k].n;
+	erow *rows = malloc(sizeof(erow) * (n ? n : 1));
+	b->line_map = realloc(b->line_map, sizeof(int) * (b->numrows + n + 1));
+	int at = 0;
+	for (int k = 0; k < chunks; k++) { 		//chunks are in row order, so the view is too
+		memcpy(&rows[at], out[k].rows, sizeof(erow) * out[k].n);
+		memcpy(&b->line_map[b->numrows + at], out[k].map, sizeof(int) * out[k].n);
+		at += out[k].n;
+		free(out[k].rows);
+		free(out[k].map);
+	}
+	editorAppendRows(b, rows, n); 			//highlights the new rows across the pool as well
+	free(rows);
+	free(out);
+	free(pat);
+}
+
+//drops every row of a view, the text belongs to the source & stays
+void editorFilterClear(editorBuffer *b) {
+	for (int j = 0; j < b->numrows; j++)
+		editorFreeRow(b, &b->row[j]);
+	b->numrows = 0;
+	b->cache_bytes = 0;
+	b->wrap_tree.stale = 1;
+	b->offsets.stale = 1;
+	b->match_len = 0;
+	b->gen++; 					//views of this view have to start over too
+}
+
+//brings a view up to date, its rows may point at text the source has freed. rows appended to the source are scanned
+//on their own, anything else that changed it means a new scan, the cursor stays on the same source line if it is still
+//there. returns 1 if the rows changed
+int editorFilterSync(editorBuffer *b) {
+	editorBuffer *src = b->source;
+	if (src == NULL) return 0;
+	editorFilterSync(src); 				//its rows come first, views only ever have plain buffers as sources though
+	if (src->gen == b->source_gen && !b->resync) {
+		if (src->numrows == b->source_rows) return 0;
+		editorFilterScan(b, b->source_rows);
+		return 1;
+	}
+	int line = b->resync ? b->cy : (b->cy < b->numrows ? b->line_map[b->cy] : -1);
+	b->resync = 0;
+	editorFilterClear(b);
+	editorFilterScan(b, 0);
+	if (line == -1) {
+		b->cy = b->numrows;
+		return 1;
+	}
+	int lo = 0, hi = b->numrows; 			//the first row at or after the line
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (b->line_map[mid] < line) lo = mid + 1;
+		else hi = mid;
+	}
+	b->cy = lo;
+	b->cx = 0;
+	return 1;
+}
+
+//called whenever the rows of some buffer may have changed under its views, before anything looks at them. the
+//active view is scanned again at once, hidden ones only drop their rows & are scanned when they are shown.
+//returns 1 if the active buffer changed
+int editorFilterSyncAll() {
+	int changed = 0;
+	for (int j = 0; j < E.numbufs; j++) {
+		editorBuffer *b = E.bufs[j];
+		if (b->source == NULL) continue;
+		if (b == E.buf) {
+			changed |= editorFilterSync(b);
+		} else if (b->source->gen != b->source_gen && !b->resync) {
+			int line = b->cy < b->numrows ? b->line_map[b->cy] : -1;
+			editorFilterClear(b);
+			b->cy = line;
+			b->resync = 1;
+		}
+	}
+	return changed;
+}
+
+//the views of a buffer that is being freed lose their rows & become plain empty buffers
+void editorFilterDetach(editorBuffer *src) {
+	for (int j = 0; j < E.numbufs; j++) {
+		editorBuffer *b = E.bufs[j];
+		if (b->source != src) continue;
+		editorFilterClear(b);
+		b->source = NULL;
+		b->resync = 0;
+		b->cy = b->cx = 0;
+		b->row_off = b->col_off = 0;
+	}
+}
+
+//prompts for a pattern & opens a view of the rows of the active buffer that match it
+void editorFilter() {
+	editorBuffer *src = E.buf;
+	if (src->source) { 				//its rows are borrowed already, filter the buffer they belong to
+		editorSetStatusMessage("Can't filter a filter view, Enter jumps to its buffer");
+		return;
+	}
+	char *filter = editorPrompt("Filter: %s (/regex/ or text, ESC to cancel)", NULL);
+	if (filter == NULL) return;
+	int regex;
+	char *pat = editorFilterPattern(filter, &regex);
+	regex_t re;
+	int err = regex ? regcomp(&re, pat, REG_EXTENDED | REG_NOSUB) : 0;
+	if (regex) {
+		if (err) {
+			char msg[80];
+			regerror(err, &re, msg, sizeof(msg));
+			editorSetStatusMessage("Bad regex %s: %s", filter, msg);
+		}
+		regfree(&re);
+	}
+	free(pat);
+	if (err) {
+		free(filter);
+		return;
+	}
+	editorBuffer *b = editorNewBuffer();
+	b->source = src;
+	b->filter = filter;
+	b->syntax = src->syntax;
+	b->wrap = src->wrap;
+	editorFilterScan(b, 0);
+	editorSwitchBuffer(E.numbufs - 1);
+	editorSetStatusMessage("%d of %d rows match, Enter jumps to the line", b->numrows, src->numrows);
+}
+
+//switches from a view to its source with the cursor on the line it came from, at the same place on screen
+void editorFilterJump() {
+	editorBuffer *b = E.buf;
+	editorBuffer *src = b->source;
+	if (b->cy >= b->numrows) return;
+	for (int j = 0; j < E.numbufs; j++) {
+		if (E.bufs[j] != src) continue;
+		src->cy = b->line_map[b->cy];
+		src->cx = b->cx;
+		src->row_off = src->cy - (b->cy - b->row_off); 	//editorScroll pulls it back in if that is off the top
+		if (src->row_off < 0) src->row_off = 0;
+		src->wrap_off = 0;
+		editorSwitchBuffer(j);
+		return;
+	}
+}
+
+/*** follow ***/
+//starts or stops appending whatever gets written to the end of the buffer's file
+void editorFollow(editorBuffer *b, int on) {
+	if (b->loader) { 					//following starts where the file ends, we don't know that yet
+		b->follow_on_load = on;
+		return;
+	}
+	if (on == b->follow) return;
+	if (!on) {
+		close(b->follow_fd);
+		int shared = 0; 				//inotify hands out one watch per inode, another buffer may still need it
+		for (int j = 0; j < E.numbufs; j++)
+			if (E.bufs[j] != b && E.bufs[j]->follow && E.bufs[j]->follow_wd == b->follow_wd) shared = 1;
+		if (!shared) inotify_rm_watch(E.inotify_fd, b->follow_wd);
+		b->follow = 0;
+		return;
+	}
+	if (b->filename == NULL || b->source || b->hex) {
+		editorSetStatusMessage("No file to follow");
+		return;
+	}
+	if (b->compressed) { 					//appended bytes would be compressed data
+		editorSetStatusMessage("Can't follow a compressed file");
+		return;
+	}
+	if (E.inotify_fd == -1 && (E.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		editorSetStatusMessage("Can't follow: inotify: %s", strerror(errno));
+		return;
+	}
+	b->follow_fd = open(b->filename, O_RDONLY);
+	if (b->follow_fd == -1) {
+		editorSetStatusMessage("Can't follow %s: %s", b->filename, strerror(errno));
+		return;
+	}
+	b->follow_wd = inotify_add_watch(E.inotify_fd, b->filename, IN_MODIFY);
+	if (b->follow_wd == -1) {
+		editorSetStatusMessage("Can't follow %s: %s", b->filename, strerror(errno));
+		close(b->follow_fd);
+		return;
+	}
+	b->follow = 1;
+	b->follow_pending = 1; 					//catch up on anything written since the file was opened
+}
+
+//reads the bytes appended to a followed file since the last call, returns 1 if rows were added
+int editorFollowRead(editorBuffer *b) {
+	static char *chunk = NULL; 				//one read buffer, shared by every followed file
+	if (chunk == NULL) chunk = malloc(KILO_FOLLOW_CHUNK);
+
+	struct stat st;
+	if (fstat(b->follow_fd, &st) == -1) return 0;
+	if (st.st_size < b->file_bytes) { 			//truncated, start over from the beginning of the new contents
+		editorSetStatusMessage("%s was truncated", b->filename);
+		for (int j = 0; j < b->numrows; j++) 		//the old rows are gone from the file, so are edits & undo records of them
+			editorFreeRow(b, &b->row[j]);
+		b->numrows = 0;
+		b->cache_bytes = 0;
+		b->wrap_tree.stale = 1;
+		b->offsets.stale = 1;
+		editorUndoFree(b);
+		b->cx = b->cy = 0;
+		b->row_off = b->col_off = b->wrap_off = 0;
+		b->match_len = 0;
+		b->dirty = 0;
+		b->gen++; 					//views of the old rows have to start over
+		b->file_bytes = 0;
+		b->partial_line = 0;
+	}
+	b->follow_pending = 0;
+	if (st.st_size == b->file_bytes) return 0;
+
+	int at_end = (b->cy >= b->numrows - 1); 		//only scroll along if the user is watching the tail
+	int dirty = b->dirty; 					//appended rows come from the file, they don't modify it
+	int chunks;
+	for (chunks = 0; chunks < KILO_FOLLOW_MAX_CHUNKS; chunks++) {
+		ssize_t nread = pread(b->follow_fd, chunk, KILO_FOLLOW_CHUNK, b->file_bytes);
+		if (nread <= 0) break;
+		editorIngest(b, chunk, nread);
+	}
+	if (chunks == KILO_FOLLOW_MAX_CHUNKS) b->follow_pending = 1;
+	b->dirty = dirty;
+
+	if (at_end && b->numrows > 0) {
+		b->cy = b->numrows - 1;
+		b->cx = 0;
+	}
+	return 1;
+}
+
+/*** events ***/
+//handles everything that can happen while we wait for a key, returns 1 if the screen needs redrawing
+int editorProcessEvents() {
+	char drain[64];
+	while (read(E.wake_pipe[0], drain, sizeof(drain)) > 0); 	//everyone who woke us gets looked at below
+	int changed = editorReapSaves(0);
+	if (E.resized) {
+		E.resized = 0;
+		changed |= editorResize();
+	}
+	int modified = 0; 					//an inotify event arrived, some followed file grew
+	if (E.inotify_fd != -1) {
+		char events[4096];
+		while (read(E.inotify_fd, events, sizeof(events)) > 0) 	//drain, we only care that something happened
+			modified = 1;
+	}
+	for (int j = 0; j < E.numbufs; j++) {
+		editorBuffer *b = E.bufs[j];
+		if (b->loader)
+			changed |= editorLoaderDrain(b, KILO_LOAD_BUDGET_MS) && b == E.buf;
+		if (b->follow && (modified || b->follow_pending))
+			changed |= editorFollowRead(b) && b == E.buf;
+		if (b->follow_pending) editorWake(); 	//read the rest right after the keyboard
+	}
+	changed |= editorFilterSyncAll(); 		//a followed file may have freed text its views point at
+	return changed;
+}
+
+//SIGWINCH, only flags it & wakes the main loop through the pipe. write() is async-signal-safe
+void editorHandleWinch(int sig) {
+	(void)sig;
+	int saved = errno;
+	E.resized = 1;
+	write(E.wake_pipe[1], "r", 1);
+	errno = saved;
+}
+
+//picks up the new terminal size. the row caches don't depend on it, wrapped buffers lay out again when next drawn
+//returns 1 if the size changed
+int editorResize() {
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) 	//keep the old size, the cursor position round trip is only worth it at startup
+		return 0;
+	int rows = ws.ws_row - 2, cols = ws.ws_col;
+	if (rows < 1) rows = 1;
+	if (rows == E.screenrows && cols == E.screencols) return 0;
+	if (cols != E.screencols) {
+		for (int j = 0; j < E.numbufs; j++) 	//unwrapped buffers stop keeping a layout for the old width
+			if (!E.bufs[j]->wrap) E.bufs[j]->wrap_width = 0;
+	}
+	E.screenrows = rows;
+	E.screencols = cols;
+	editorScreenReset(); 				//the terminal may have reflowed or scrolled what it showed
+	return 1;
+}
+
+//wakes the main loop out of editorWaitInput, safe to call from any thread
+void editorWake() {
+	write(E.wake_pipe[1], "w", 1); 				//if the pipe is full the main loop is already awake
+}
+
+//sleeps until a key arrives or something wakes us, returns 1 if there is a key to read
+int editorWaitInput() {
+	struct pollfd fds[3];
+	int nfds = 0;
+	fds[nfds].fd = STDIN_FILENO;
+	fds[nfds++].events = POLLIN;
+	fds[nfds].fd = E.wake_pipe[0];
+	fds[nfds++].events = POLLIN;
+	if (E.inotify_fd != -1) {
+		fds[nfds].fd = E.inotify_fd;
+		fds[nfds++].events = POLLIN;
+	}
+	if (poll(fds, nfds, 1000) <= 0) return 0; 		//timed out or interrupted, look at the events anyway
+	return (fds[0].revents & POLLIN) != 0;
+}
+
+/*** find ***/
+
+//finds a string in the file
+void editorFindCallback(char* query, int key) {
+	editorBuffer *b = E.buf;
+	static int last_match = -1;
+	static int direction = 1;
+
+	b->match_len = 0; 					//stop drawing the previous match
+
+	if (key == '\r' || key == '\x1b') { 			//IF ESCAPE OR RETURN
+		last_match = -1; 				//reset last_match on exiting search
+		direction = 1; 					//reset direction on exiting search
+		return;
+	} else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+		direction = 1;
+	} else if (key == ARROW_LEFT || key == ARROW_UP) {
+		direction = -1;
+	} else {
+		direction = 1;
+		last_match = -1;
+	}
+	if (last_match == -1) direction = 1;
+	int current = last_match; 				//index of the current row we are searching
+	int i;
+	for (i = 0; i < b->numrows; i++) { 			//FOR-EACH row in the editor
+		current += direction; 				//decrement if we are searching backwards, increment if we are moving forwards
+		if (current == -1) current = b->numrows - 1; 	//if the current match was moved to before the file, wrap around to the end of the file
+		else if (current == b->numrows) current = 0; 	//IF the current match is at the end of the file, move to the beginning of the file
+
+		erow *row = &b->row[current]; 			//set var to current row
+		editorRowEnsureCache(b, row); 			//render may have been released while the buffer was hidden
+		char *match = strstr(row->render, query); 	//returns a pointer to the first occurence of the QUERY in the row
+		if (match) { 					//if the pointer is not NULL, meaning we have a match
+			last_match = current; 			//update the last_match to be the current match
+			b->cy = current; 			//set the cursor to the current row
+			b->cx = editorRowSeek(row, COL_BY_RX, match - row->render).cx; 	//set the cursor to the beginning of the match
+			b->row_off = b->numrows;  		//set row_offset to the bottom of the file so that the editorScroll will bring us to the matching line(top of screen)
+
+			b->match_row = current; 		//highlight the match, it is drawn over the spans of the row
+			b->match_start = match - row->render;
+			b->match_len = strlen(query);
+			break; 					//break to end the search
+		}
+	}
+}
+//editor find, calls callback
+void editorFind() {
+	editorBuffer *b = E.buf;
+	//save context information
+	int saved_cx = b->cx;
+	int saved_cy = b->cy;
+	int saved_coloff = b->col_off;
+	int saved_rowoff = b->row_off;
+
+	char *query = editorPrompt("Search %s (ESC to cancel/ARROWS to navigate/Enter to find)", editorFindCallback);
+	if (query) free(query); 				//free the query, if it exists
+	else {
+		//restore context
+		b->cx 		= saved_cx; 
+		b->cy 		= saved_cy; 
+		b->col_off 	= saved_coloff; 
+		b->row_off 	= saved_rowoff; 
+	}
+}
+
+/*** replace ***/
+//replaces every occurrence of query in the buffer, returns how many. each changed row is built in one pass into one
+//allocation & rebuilt & highlighted once, its old text goes to the undo log as it is so the whole thing is one undo
+long long editorReplaceAll(editorBuffer *b, const char *query, const char *with, int *rows) {
+	int qlen = strlen(query), wlen = strlen(with);
+	int *at = NULL, atcap = 0; 				//where query is in the current row
+	long long count = 0;
+	*rows = 0;
+	if (qlen == 0) return 0;
+	editorLoadFinish(b); 					//rows still to come would arrive unreplaced
+	if (editorPrepareEdit(b) == -1) return 0;
+	editorUndoBegin(b);
+	b->match_len = 0; 					//the search hit may not be there any more
+	for (int j = 0; j < b->numrows; j++) {
+		erow *row = &b->row[j];
+		int nat = 0;
+		char *p = row->chars, *end = row->chars + row->size;
+		while ((p = memmem(p, end - p, query, qlen)) != NULL) {
+			if (nat == atcap) {
+				atcap = atcap ? atcap * 2 : 16;
+				at = realloc(at, sizeof(int) * atcap);
+			}
+			at[nat++] = p - row->chars;
+			p += qlen;
+		}
+		if (nat == 0) continue;
+		int size = row->size + nat * (wlen - qlen);
+		char *chars = malloc(size + 1);
+		char *out = chars;
+		int from = 0;
+		for (int k = 0; k < nat; k++) { 		//the text up to the match, then the replacement
+			memcpy(out, &row->chars[from], at[k] - from);
+			out += at[k] - from;
+			memcpy(out, with, wlen);
+			out += wlen;
+			from = at[k] + qlen;
+		}
+		memcpy(out, &row->chars[from], row->size - from);
+		chars[size] = '\0';
+		editorRowUnshare(row);
+		editorUndoPush(b, UNDO_TEXT, j, row->chars, row->size); 	//the old text is kept, not copied
+		row->chars = chars;
+		row->size = size;
+		editorUpdateRow(b, row);
+		b->dirty++;
+		b->gen++;
+		count += nat;
+		(*rows)++;
+	}
+	free(at);
+	if (b->cy < b->numrows) 				//the cursor row may have got shorter
+		b->cx = editorRowSeek(&b->row[b->cy], COL_BY_CX, b->cx).cx;
+	return count;
+}
+
+void editorReplace() {
+	editorBuffer *b = E.buf;
+	if (editorPrepareEdit(b) == -1) return;
+	char *query = editorPrompt("Replace: %s (ESC to cancel)", NULL);
+	if (query == NULL) return;
+	char *with = editorPrompt("Replace with: %s (ESC to cancel)", NULL);
+	if (with == NULL) {
+		free(query);
+		return;
+	}
+	int rows;
+	long long count = editorReplaceAll(b, query, with, &rows);
+	editorSetStatusMessage("Replaced %lld occurrences in %d rows, ^Z to undo", count, rows);
+	free(query);
+	free(with);
+}
+
+/*** go to ***/
+//moves the cursor to a byte offset of the file, a row & its new-line (with a \r that was stripped) are found in O(log n)
+void editorGotoOffset(editorBuffer *b, long long offset) {
+	if (b->numrows == 0) return;
+	struct rowTree *t = &b->offsets;
+	if (t->sum == NULL || t->stale || t->n != b->numrows) 	//first use or rows moved, O(n) once. edits keep it up to date
+		rowTreeBuild(t, b, rowBytes);
+	long long off;
+	int at = rowTreeFind(t, offset, &off);
+	if (at >= b->numrows) { 				//past the end of the file, go to its end
+		at = b->numrows - 1;
+		off = b->row[at].size;
+	}
+	erow *row = &b->row[at];
+	editorRowEnsureCache(b, row); 				//an evicted row needs its chars back to find a character in it
+	if (off > row->size) off = row->size; 			//on the new-line
+	b->cy = at;
+	b->cx = editorRowSeek(row, COL_BY_CX, off).cx; 		//the start of the character the byte is in
+}
+
+//prompts for a line number, or a byte offset after '@', & jumps there
+void editorGoto() {
+	editorBuffer *b = E.buf;
+	char *query = editorPrompt("Go to line, or @byte offset: %s (ESC to cancel)", NULL);
+	if (query == NULL) return;
+	int by_offset = (query[0] == '@');
+	char *end;
+	errno = 0;
+	long long n = strtoll(query + by_offset, &end, 0); 	//0x.. for offsets from hex dumps
+	if (end == query + by_offset || *end != '\0' || n < 0 || errno) {
+		editorSetStatusMessage("Not a line number or offset: %s", query);
+		free(query);
+		return;
+	}
+	if (b->hex) { 						//lines of the hex view, or a byte of the file
+		b->hex_cur = by_offset ? n : (n > 0 ? n - 1 : 0) * KILO_HEX_WIDTH;
+		if (b->hex_cur >= (long long)b->map_len) b->hex_cur = b->map_len ? (long long)b->map_len - 1 : 0;
+		b->hex_top = b->hex_cur / KILO_HEX_WIDTH; 	//to the top of the screen, like the rows
+	} else if (by_offset) {
+		editorGotoOffset(b, n);
+	} else { 						//lines count from 1, a row is just an index
+		b->cy = (n > b->numrows) ? b->numrows : (n > 0 ? n - 1 : 0);
+		b->cx = 0;
+	}
+	b->row_off = b->numrows; 				//editorScroll brings the line to the top of the screen, like find
+	free(query);
+}
+
+/*** hex view ***/
+//the hex view formats the screen straight out of a read-only mapping of the file, no rows are made for it so a file
+//of any size opens at once. a file truncated under the mapping while it is shown ends kilo with SIGBUS
+
+//maps the file behind fd, which can be closed afterwards, & switches the buffer to the hex view
+int editorHexMap(editorBuffer *b, int fd) {
+	struct stat st;
+	if (fstat(fd, &st) == -1) return -1;
+	void *map = NULL;
+	if (st.st_size > 0) { 				//an empty file can't be mapped, there is nothing to show anyway
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) return -1;
+	}
+	b->map = map;
+	b->map_len = st.st_size;
+	b->hex = 1;
+	if (b->hex_cur >= (long long)b->map_len) b->hex_cur = b->map_len ? (long long)b->map_len - 1 : 0;
+	return 0;
+}
+
+void editorHexUnmap(editorBuffer *b) {
+	if (b->map) munmap((void *)b->map, b->map_len);
+	b->map = NULL;
+	b->map_len = 0;
+	b->hex = 0;
+}
+
+//columns taken by the offsets, enough for the last byte of the file & never fewer than 8
+int editorHexDigits(editorBuffer *b) {
+	int digits = 8;
+	while (digits < 16 && (unsigned long long)b->map_len >> (4 * digits)) digits++;
+	return digits;
+}
+
+//switches the active buffer between its rows & a hex dump of its file, keeping the cursor on the same byte
+void editorToggleHex() {
+	editorBuffer *b = E.buf;
+	int exact = (!b->dirty && !b->compressed); 	//the rows are the file byte for byte, offsets carry over
+	if (b->hex) {
+		editorHexUnmap(b);
+		if (b->numrows == 0 && b->loader == NULL) { 	//opened as binary, the rows were never read
+			int fd = open(b->filename, O_RDONLY);
+			if (fd == -1) {
+				editorSetStatusMessage("Can't open %s: %s", b->filename, strerror(errno));
+				return;
+			}
+			editorLoad(b, fd, 0);
+			b->cy = b->cx = 0;
+		} else if (exact) {
+			editorGotoOffset(b, b->hex_cur);
+		}
+		editorSetStatusMessage("Hex view off");
+		return;
+	}
+	if (b->filename == NULL || b->source) {
+		editorSetStatusMessage("No file to show in hex");
+		return;
+	}
+	int fd = open(b->filename, O_RDONLY);
+	if (fd == -1 || editorHexMap(b, fd) == -1) {
+		editorSetStatusMessage("Can't map %s: %s", b->filename, strerror(errno));
+		if (fd != -1) close(fd);
+		return;
+	}
+	close(fd);
+	b->hex_cur = 0;
+	if (exact && b->cy < b->numrows) { 			//the offset of the cursor, from the byte tree of the rows
+		struct rowTree *t = &b->offsets;
+		if (t->sum == NULL || t->stale || t->n != b->numrows) rowTreeBuild(t, b, rowBytes);
+		b->hex_cur = rowTreePrefix(t, b->cy) + b->cx;
+		if (b->hex_cur >= (long long)b->map_len) b->hex_cur = b->map_len ? (long long)b->map_len - 1 : 0;
+	}
+	editorSetStatusMessage(b->dirty ? "Hex view of %s as it is on disk, without the unsaved changes" :
+			"Hex view of %s (^B to go back)", b->filename);
+}
+
+//moves the cursor of the hex view, a byte or a line at a time with the arrows
+void editorHexMove(int key) {
+	editorBuffer *b = E.buf;
+	long long cur = b->hex_cur;
+	long long page = (long long)E.screenrows * KILO_HEX_WIDTH;
+	switch (key) {
+		case ARROW_LEFT: 	cur--; break;
+		case ARROW_RIGHT: 	cur++; break;
+		case ARROW_UP: 		if (cur >= KILO_HEX_WIDTH) cur -= KILO_HEX_WIDTH; break;
+		case ARROW_DOWN: 	if (cur + KILO_HEX_WIDTH < (long long)b->map_len) cur += KILO_HEX_WIDTH; break;
+		case PAGE_UP: 		cur -= page; b->hex_top -= E.screenrows; break; 	//the screen moves with it
+		case PAGE_DOWN: 	cur += page; b->hex_top += E.screenrows; break;
+		case HOME_KEY: 		cur -= cur % KILO_HEX_WIDTH; break;
+		case END_KEY: 		cur += KILO_HEX_WIDTH - 1 - cur % KILO_HEX_WIDTH; break;
+	}
+	if (cur >= (long long)b->map_len) cur = (long long)b->map_len - 1;
+	if (cur < 0) cur = 0;
+	b->hex_cur = cur;
+}
+
+/*** append buffer ***/
+/* To reduce the amount of write() calls we make. Thus, reducing flicker & unexpected behavior */
 struct abuf { 		//the append buffer
 	char *b; 	//pointer to buffer
 	int len; 	//length of buffer
@@ -723,36 +3608,243 @@ void abFree(struct abuf *ab) {
 	free(ab->b);
 }
 
+/*** output layer ***/
+//writes what is queued, a slow terminal only holds up this thread. partial writes carry on where they stopped
+void *editorOutputThread(void *arg) {
+	struct editorOutput *o = arg;
+	pthread_mutex_lock(&o->lock);
+	while (1) {
+		while (o->tail == o->head) pthread_cond_wait(&o->more, &o->lock);
+		size_t at = o->tail & (o->cap - 1);
+		size_t len = o->head - o->tail;
+		if (len > o->cap - at) len = o->cap - at; 	//up to the end of the ring, the rest comes next time round
+		o->taken = o->tail + len;
+		if (o->queued >= 0 && (unsigned long long)o->queued < o->taken) o->queued = -1; 	//started, too late to drop it
+		char *p = o->ring + at;
+		pthread_mutex_unlock(&o->lock);
+
+		struct timespec t0, t1;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		size_t done = 0;
+		while (done < len) {
+			ssize_t n = write(STDOUT_FILENO, p + done, len - done);
+			if (n > 0) {
+				done += n;
+			} else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				struct pollfd pfd = { STDOUT_FILENO, POLLOUT, 0 };
+				poll(&pfd, 1, -1);
+			} else if (n == -1 && errno != EINTR) {
+				break; 					//the terminal is gone, let the frame go
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+
+		pthread_mutex_lock(&o->lock);
+		o->tail += len;
+		o->bytes += done;
+		o->write_secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+		pthread_cond_broadcast(&o->space);
+	}
+	return NULL;
+}
+
+void editorOutputInit() {
+	struct editorOutput *o = &E.out;
+	memset(o, 0, sizeof(*o));
+	pthread_mutex_init(&o->lock, NULL);
+	pthread_cond_init(&o->more, NULL);
+	pthread_cond_init(&o->space, NULL);
+	o->cap = KILO_OUT_RING;
+	o->ring = malloc(o->cap);
+	o->queued = -1;
+	if (editorThreadCreate(&o->thread, editorOutputThread, o) != 0) die("pthread_create");
+}
+
+//queues bytes for the terminal. a frame replaces the frame queued before it if none of that was written yet,
+//frames are drawn so that they are right on top of either of the two screens that leaves
+//returns 1 if that happened
+int editorOutputQueue(const char *s, size_t len, int frame) {
+	struct editorOutput *o = &E.out;
+	int dropped = 0;
+	pthread_mutex_lock(&o->lock);
+	if (frame && o->queued >= 0) { 			//still untouched, take it back out of the ring
+		o->head = o->queued;
+		o->dropped++;
+		dropped = 1;
+	}
+	o->queued = -1;
+	while (o->head + len - o->tail > o->cap) { 	//no room, wait for the writer or grow once it is done
+		if (o->tail == o->head) {
+			while (o->cap < 2 * len) o->cap *= 2;
+			free(o->ring);
+			o->ring = malloc(o->cap);
+			o->head = o->tail = o->taken = 0;
+		} else {
+			pthread_cond_wait(&o->space, &o->lock);
+		}
+	}
+	if (frame) {
+		o->queued = o->head;
+		o->frames++;
+	}
+	size_t at = o->head & (o->cap - 1);
+	size_t first = len < o->cap - at ? len : o->cap - at; 	//up to the end of the ring, then from its start
+	memcpy(o->ring + at, s, first);
+	memcpy(o->ring, s + first, len - first);
+	o->head += len;
+	pthread_cond_signal(&o->more);
+	pthread_mutex_unlock(&o->lock);
+	return dropped;
+}
+
+//whether the last frame queued could still be dropped, once the writer takes it the answer stays 0
+int editorOutputPending() {
+	struct editorOutput *o = &E.out;
+	pthread_mutex_lock(&o->lock);
+	int pending = o->queued >= 0;
+	pthread_mutex_unlock(&o->lock);
+	return pending;
+}
+
+//waits until everything queued is on the terminal
+void editorOutputFlush() {
+	struct editorOutput *o = &E.out;
+	pthread_mutex_lock(&o->lock);
+	while (o->tail != o->head) pthread_cond_wait(&o->space, &o->lock);
+	pthread_mutex_unlock(&o->lock);
+}
+
+void editorOutputStats() {
+	struct editorOutput *o = &E.out;
+	pthread_mutex_lock(&o->lock);
+	double rate = o->write_secs > 0 ? o->bytes / o->write_secs : 0;
+	editorSetStatusMessage("Output: %.1f KB/s | %lu frames | %lu dropped | %llu KB written",
+			rate / 1024, o->frames, o->dropped, o->bytes / 1024);
+	pthread_mutex_unlock(&o->lock);
+}
+
 /*** output ***/
+//forgets what is on screen, the next frame draws every line
+void editorScreenReset() {
+	E.screen_lines = E.screenrows + 2;
+	size_t bytes = sizeof(unsigned long) * E.screen_lines;
+	E.screen_cur = realloc(E.screen_cur, bytes);
+	E.screen_base = realloc(E.screen_base, bytes);
+	E.screen_next = realloc(E.screen_next, bytes);
+	memset(E.screen_cur, 0, bytes);
+	memset(E.screen_base, 0, bytes);
+	memset(E.screen_next, 0, bytes);
+}
+
+//appends screen line y to the frame unless the terminal has it already, whichever of the last two frames it ends up with
+void editorEmitLine(struct abuf *frame, int y, struct abuf *line) {
+	unsigned long h = 5381;
+	for (int i = 0; i < line->len; i++) h = h * 33 + (unsigned char)line->b[i];
+	h |= 1; 					//0 is for lines we know nothing about
+	if (h != E.screen_cur[y] || h != E.screen_base[y]) {
+		char buf[16];
+		int clen = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1); 	//to the start of the line
+		abAppend(frame, buf, clen);
+		if (line->len) abAppend(frame, line->b, line->len); 	//an empty line has no buffer at all
+		abAppend(frame, "\x1b[K", 3); 		// K = Erase in line
+	}
+	E.screen_next[y] = h;
+	abFree(line);
+}
+
+//keeps the cursor on screen counting screen lines instead of rows, two tree lookups whatever the size of the file
+void editorScrollWrapped() {
+	editorBuffer *b = E.buf;
+	editorWrapLayout(b);
+	int line = 0, x = 0;
+	if (b->cy < b->numrows) {
+		erow *row = &b->row[b->cy];
+		editorRowWrapFind(row, b->wrap_width, editorRowSeek(row, COL_BY_CX, b->cx).rx, &line, &x);
+	}
+	if (b->row_off > b->numrows) b->row_off = b->numrows;
+	long long cur = rowTreePrefix(&b->wrap_tree, b->cy) + line; 	//screen line of the cursor in the whole buffer
+	long long top = rowTreePrefix(&b->wrap_tree, b->row_off) + b->wrap_off;
+	if (cur < top) top = cur;
+	if (cur >= top + E.screenrows) top = cur - E.screenrows + 1;
+	long long off;
+	b->row_off = rowTreeFind(&b->wrap_tree, top, &off);
+	b->wrap_off = off;
+	b->col_off = 0;
+	b->cur_y = cur - top;
+	b->cur_x = x;
+}
+
+//keeps the cursor of the hex view on screen, the cursor goes on the high digit of its byte
+void editorHexScroll() {
+	editorBuffer *b = E.buf;
+	long long line = b->hex_cur / KILO_HEX_WIDTH;
+	long long last = b->map_len ? ((long long)b->map_len - 1) / KILO_HEX_WIDTH : 0;
+	if (b->hex_top > last) b->hex_top = last;
+	if (b->hex_top < 0) b->hex_top = 0;
+	if (line < b->hex_top) b->hex_top = line;
+	if (line >= b->hex_top + E.screenrows) b->hex_top = line - E.screenrows + 1;
+	int col = b->hex_cur % KILO_HEX_WIDTH;
+	b->cur_y = line - b->hex_top;
+	b->cur_x = editorHexDigits(b) + 2 + col * 3 + (col >= KILO_HEX_WIDTH / 2); 	//offset, gap, "xx " per byte, gap half-way
+	if (b->cur_x >= E.screencols) b->cur_x = E.screencols > 0 ? E.screencols - 1 : 0;
+}
+
 void editorScroll() {
-	E.rx = 0;
-	if (E.cy < E.numrows)
-		E.rx = editorRowCxtoRx(&E.row[E.cy], E.cx);
+	editorBuffer *b = E.buf;
+	if (b->hex) {
+		editorHexScroll();
+		return;
+	}
+	b->rx = 0;
+	if (b->cy < b->numrows) {
+		editorRowEnsureCache(b, &b->row[b->cy]); 	//the cursor may have moved onto an evicted row
+		b->rx = editorRowCxtoRx(&b->row[b->cy], b->cx);
+	}
+	if (b->wrap) {
+		editorScrollWrapped();
+		return;
+	}
 
-	if (E.cy < E.row_off) {
-		E.row_off = E.cy;
+	if (b->cy < b->row_off) {
+		b->row_off = b->cy;
 	}
-	if (E.cy >= E.row_off + E.screenrows) {
-		E.row_off = E.cy - E.screenrows + 1;
+	if (b->cy >= b->row_off + E.screenrows) {
+		b->row_off = b->cy - E.screenrows + 1;
 	}
-	if (E.rx < E.col_off) {
-		E.col_off = E.rx;
+	if (b->rx < b->col_off) {
+		b->col_off = b->rx;
 	}
-	if (E.rx > E.col_off + E.screencols) {
-		E.col_off = E.rx - E.screencols + 1;
+	if (b->rx > b->col_off + E.screencols) {
+		b->col_off = b->rx - E.screencols + 1;
 	}
+	b->cur_y = b->cy - b->row_off;
+	b->cur_x = b->rx - b->col_off;
 }
 
-void editorDrawStatusBar(struct abuf *ab) {
+void editorDrawStatusBar(struct abuf *frame) {
+	editorBuffer *b = E.buf;
+	struct abuf line = ABUF_INIT;
+	struct abuf *ab = &line;
 	abAppend(ab,"\x1b[7m", 4);
 	
 	char status[80], rstatus[80];
-	int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-			E.filename ? E.filename : "[No Name]",
-			E.numrows,
-			E.dirty ? "(modified)" : "");
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
-			E.syntax ? E.syntax->filetype : "no ft",E.cy + 1, E.numrows);
+	char loading[20] = "";
+	if (b->loader) snprintf(loading, sizeof(loading), " [loading %d%%]", b->load_percent);
+	int len, rlen;
+	if (b->hex) { 					//bytes, there may be no rows
+		len = snprintf(status, sizeof(status), "[%d/%d] %.20s - %zu bytes [hex]",
+				E.curbuf + 1, E.numbufs, b->filename, b->map_len);
+		rlen = snprintf(rstatus, sizeof(rstatus), "hex | 0x%llx", b->hex_cur);
+	} else {
+		len = snprintf(status, sizeof(status), "[%d/%d] %.20s - %d lines %s%s",
+				E.curbuf + 1, E.numbufs,
+				b->filename ? b->filename : b->filter ? b->filter : "[No Name]",
+				b->numrows,
+				b->dirty ? "(modified)" : "",
+				b->follow ? " [follow]" : b->source ? " [filter]" : loading);
+		rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+				b->syntax ? b->syntax->filetype : "no ft",b->cy + 1, b->numrows);
+	}
 	if (len > E.screencols) len = E.screencols;
 	abAppend(ab, status, len);
 	while (len < E.screencols) {
@@ -765,23 +3857,140 @@ void editorDrawStatusBar(struct abuf *ab) {
 		}
 	}
 	abAppend(ab, "\x1b[m",3);
-	abAppend(ab, "\r\n",2);
+	editorEmitLine(frame, E.screenrows, ab);
 }
 
-void editorDrawMessageBar(struct abuf *ab) {
-	abAppend(ab, "\x1b[K", 3);
+void editorDrawMessageBar(struct abuf *frame) {
+	struct abuf line = ABUF_INIT;
 	int msglen = strlen(E.statusmsg);
 	if (msglen > E.screencols) msglen = E.screencols;
 	if (msglen && time(NULL) - E.statusmsg_time < 5)
-		abAppend(ab, E.statusmsg, msglen);
+		abAppend(&line, E.statusmsg, msglen);
+	editorEmitLine(frame, E.screenrows + 1, &line);
+}
+
+//appends a run of render characters drawn in one color, control characters & bytes that aren't UTF-8 show up inverted as a symbol
+void editorDrawText(struct abuf *ab, const char *c, int len, int color) {
+	int from = 0; 							//start of the printable characters not appended yet
+	int j = 0;
+	while (j < len) {
+		int cp, n = 1;
+		if ((unsigned char)c[j] < 0x80) { 				//ASCII, the common case
+			if (!iscntrl(c[j])) { j++; continue; }
+			cp = c[j];
+		} else {
+			n = utf8Decode(&c[j], len - j, &cp);
+			if (cp >= 0xa0) { j += n; continue; } 		//printable, the terminal draws it
+		}
+		abAppend(ab, &c[from], j - from);
+		char sym = (cp >= 0 && cp < 26) ? '@' + cp : '?'; 	//convert the control character to a symbol from A-Z (1-26) & @ (0), else '?'
+		abAppend(ab, "\x1b[7m",4); 					//invert color
+		abAppend(ab, &sym,1); 						//print the symbol
+		abAppend(ab, "\x1b[m",3); 					//reset the color
+		if (color != -1) { 						//if a color is set
+			char buf[16];
+			int clen = snprintf(buf, sizeof(buf),"\x1b[%dm", color);
+			abAppend(ab, buf, clen);
+		}
+		j += n;
+		from = j;
+	}
+	abAppend(ab, &c[from], len - from);
+}
+
+//draws render[j, end) of a row, coloured by its spans with the search hit on top
+void editorDrawRow(struct abuf *ab, editorBuffer *b, int filerow, int j, int end) {
+	erow *row = &b->row[filerow];
+	int match_start = -1, match_end = -1; 			//the search hit, if it is on this row
+	if (b->match_len > 0 && b->match_row == filerow) {
+		match_start = b->match_start;
+		match_end = b->match_start + b->match_len;
+	}
+	int s = 0; 						//the first span that isn't left of the screen
+	while (s < row->nhl && row->hl[s].start + (int)row->hl[s].len <= j) s++;
+	int current_color = -1;
+	while (j < end) { 					//one run of characters sharing a highlight at a time
+		int hl = HL_NORMAL;
+		int next = end; 				//where the run ends
+		if (s < row->nhl && row->hl[s].start <= j) {
+			hl = row->hl[s].hl;
+			next = row->hl[s].start + row->hl[s].len;
+		} else if (s < row->nhl) {
+			next = row->hl[s].start; 		//normal text up to the next span
+		}
+		if (j >= match_start && j < match_end) { 	//the match overlays whatever is under it
+			hl = HL_MATCH;
+			next = match_end;
+		} else if (match_start > j && match_start < next) {
+			next = match_start;
+		}
+		if (next > end) next = end;
+
+		int color = (hl == HL_NORMAL) ? -1 : editorSyntaxToColor(hl);
+		if (color != current_color) {
+			current_color = color;
+			if (color == -1) {
+				abAppend(ab, "\x1b[39m",5); 	//set color to normal
+			} else {
+				char buf[16];
+				int clen = snprintf(buf, sizeof(buf), "\x1b[%dm",color);
+				abAppend(ab, buf, clen);
+			}
+		}
+		editorDrawText(ab, &row->render[j], next - j, current_color);
+		j = next;
+		while (s < row->nhl && row->hl[s].start + (int)row->hl[s].len <= j) s++;
+	}
+	abAppend(ab, "\x1b[39m",5); //set color to normal
+}
+
+//draws the visible lines of the hex view: offset, the bytes in hex & as text. nothing off screen is read
+void editorDrawHex(struct abuf *frame) {
+	static const char digits[] = "0123456789abcdef";
+	editorBuffer *b = E.buf;
+	int width = editorHexDigits(b);
+	for (int y = 0; y < E.screenrows; y++) {
+		struct abuf line = ABUF_INIT;
+		long long off = (b->hex_top + y) * KILO_HEX_WIDTH;
+		if (off >= (long long)b->map_len) {
+			abAppend(&line, "~", 1);
+		} else {
+			char buf[40 + 4 * KILO_HEX_WIDTH];
+			int len = snprintf(buf, sizeof(buf), "%0*llx  ", width, off);
+			int n = (long long)b->map_len - off < KILO_HEX_WIDTH ? (int)(b->map_len - off) : KILO_HEX_WIDTH;
+			const unsigned char *p = b->map + off;
+			for (int i = 0; i < KILO_HEX_WIDTH; i++) {
+				if (i == KILO_HEX_WIDTH / 2) buf[len++] = ' ';
+				buf[len++] = i < n ? digits[p[i] >> 4] : ' ';
+				buf[len++] = i < n ? digits[p[i] & 15] : ' ';
+				buf[len++] = ' ';
+			}
+			buf[len++] = ' ';
+			buf[len++] = '|';
+			for (int i = 0; i < n; i++) 		//anything but printable ASCII is a dot
+				buf[len++] = (p[i] >= 0x20 && p[i] < 0x7f) ? p[i] : '.';
+			buf[len++] = '|';
+			abAppend(&line, buf, len < E.screencols ? len : E.screencols);
+		}
+		editorEmitLine(frame, y, &line);
+	}
 }
 
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows(struct abuf *frame) {
+	editorBuffer *b = E.buf;
+	if (b->hex) {
+		editorDrawHex(frame);
+		return;
+	}
 	int y;
+	int filerow = b->row_off; 					//the file row on the current screen line
+	int sub = b->wrap ? b->wrap_off : 0; 			//which of its wrapped lines, always 0 unless soft wrapped
+	int wrap_j = -1; 						//render index the wrapped line starts at, -1 = look it up
 	for (y = 0; y < E.screenrows; y++) { 				//for-each row in the screen
-		int filerow = y + E.row_off; 				//the current visible line of the file
-		if (filerow >= E.numrows) { 				//if the file-row is greater than the number of rows in the editor
-			if (E.numrows == 0 && y == E.screenrows / 3) { 	//WELCOME MESSAGE
+		struct abuf line = ABUF_INIT; 				//drawn on its own, so it can be left out if it didn't change
+		struct abuf *ab = &line;
+		if (filerow >= b->numrows) { 				//if the file-row is greater than the number of rows in the editor
+			if (b->numrows == 0 && y == E.screenrows / 3) { 	//WELCOME MESSAGE
 				char welcome[80];
 				int welcomelen = snprintf(welcome, sizeof(welcome),
 						"Kilo editor -- version %s", KILO_VERSION);
@@ -799,74 +4008,77 @@ void editorDrawRows(struct abuf *ab) {
 				abAppend(ab, "~",1);
 			}
 		}
+		else if (b->wrap) { 					//the next screen line of a wrapped row
+			editorRowEnsureCache(b, &b->row[filerow]); 		//rebuild render & hl if they were released
+			erow *row = &b->row[filerow];
+			int j = wrap_j >= 0 ? wrap_j : editorRowWrapStart(row, b->wrap_width, sub);
+			int end = editorRowFit(row, j, b->wrap_width);
+			editorDrawRow(ab, b, filerow, j, end);
+			wrap_j = end;
+			if (++sub >= row->vlines) { 			//on to the first line of the next row
+				filerow++;
+				sub = 0;
+				wrap_j = -1;
+			}
+		}
 		else { //NOT (filerow>=numRows) 				//ACTUAL CONTENT
-			int len = E.row[filerow].rsize - E.col_off; 		//the length of the visible line
-			if (len < 0) len = 0; 					//validate length
-			if (len > E.screencols) len = E.screencols; 		//if the length is greater than the currently visible columns, truncate length
-			char *c = &E.row[filerow].render[E.col_off]; 		//pointer to the first visible character in a row
-			unsigned char *hl = &E.row[filerow].hl[E.col_off]; 	//the current highlight
-			int current_color = -1;
-			int j;
-			for (j = 0; j < len; j++) { 					//for each character in the visible segment of the row
-				if (iscntrl(c[j])) { 					//IF character IS control character
-					char sym = (c[j] < 26) ? '@' + c[j] : '?'; 	//convert the control character to a symbol from A-Z (1-26) & @ (0), else '?'
-					abAppend(ab, "\x1b[7m",4); 			//invert color
-					abAppend(ab, &sym,1); 				//print the symbol
-					abAppend(ab, "\x1b[m",3); 			//reset the color
-					if (current_color != -1) { 			//if a color is set
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf),"\x1b[%dm", current_color);
-						abAppend(ab, buf, clen);
-					}
-
-				}
-				else if (hl[j] == HL_NORMAL) { 				//if of normal highlight
-					if (current_color != -1) {
-						abAppend(ab, "\x1b[39m",5); 		//set color to normal
-						current_color = -1;
-					}
-					abAppend(ab, &c[j],1); 				//print character
-				}
-				else {
-					int color = editorSyntaxToColor(hl[j]);		//get the color for the syntax
-					if (color != current_color) {
-						current_color = color;
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm",color);
-						abAppend(ab, buf, clen);
+			editorRowEnsureCache(b, &b->row[filerow]); 		//rebuild render & hl if they were released
+			erow *row = &b->row[filerow];
+			int j; 							//render index of the first visible character
+			int cols = 0; 						//screen columns used before it
+			if (row->plain) { 					//a byte is a column
+				j = b->col_off < row->rsize ? b->col_off : row->rsize;
+			} else {
+				struct rowCol pos = editorRowSeek(row, COL_BY_COL, b->col_off);
+				j = pos.rx;
+				if (pos.col < b->col_off && pos.cx < row->size) { 	//a character straddles the left edge
+					struct rowCol next = pos;
+					editorRowStep(row, &next);
+					if (row->chars[pos.cx] == '\t') { 	//tabs are spaces in render, start part way in
+						j += b->col_off - pos.col;
+					} else { 				//half a wide character, pad it out
+						for (cols = 0; cols < next.col - b->col_off && cols < E.screencols; cols++)
+							abAppend(ab, " ", 1);
+						j = next.rx;
 					}
-					abAppend(ab, &c[j], 1); 			//print character
 				}
 			}
-			abAppend(ab, "\x1b[39m",5); //set color to normal
+			editorDrawRow(ab, b, filerow, j, editorRowFit(row, j, E.screencols - cols));
+			filerow++;
 		}
-		abAppend(ab, "\x1b[K",3); 	// K = Erase in line
-		abAppend(ab, "\r\n", 2);		
+		editorEmitLine(frame, y, ab);
 	}
 }
 //refresh the screen
 void editorRefreshScreen() {
+	editorBuffer *b = E.buf;
+	editorFilterSyncAll(); 				//the source may have changed or grown since the last frame
 	editorScroll();
 	struct abuf ab = ABUF_INIT;
 	abAppend(&ab,"\x1b[?25l",6);
 		//l 	| reset mode
 		//?25 	| not in the usually associated vt100 documents; however, it should hide the cursor
-	abAppend(&ab, "\x1b[H", 3); 	//move the cursor to the 1st row & 1st column
-		//H - "Cursor Position" (https://vt100.net/docs/vt100-ug/chapter3.html#CUP)
-
-	editorDrawRows(&ab);
+	if (E.screen_lines != E.screenrows + 2) editorScreenReset();
+	if (!editorOutputPending()) 			//the last frame is being written, so the screen will be just that
+		memcpy(E.screen_base, E.screen_cur, sizeof(unsigned long) * E.screen_lines);
+	editorDrawRows(&ab); 				//every line positions the cursor itself, only lines that changed are sent
 	editorDrawStatusBar(&ab);
 	editorDrawMessageBar(&ab);
 
 	char buf[32];
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.row_off) + 1, (E.rx - E.col_off) + 1);
+	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", b->cur_y + 1, b->cur_x + 1);
 	abAppend(&ab, buf, strlen(buf));
 
 	abAppend(&ab,"\x1b[?25h",6);
 		//h 	| set mode
 		//?25l, see above, this should show the cursor?
 	
-	write(STDOUT_FILENO, ab.b, ab.len);
+	if (!editorOutputQueue(ab.b, ab.len, 1)) { 	//the writer thread puts it on the terminal, or a newer frame replaces it
+		unsigned long *t = E.screen_base; 	//the last frame made it, the one before can be forgotten
+		E.screen_base = E.screen_cur;
+		E.screen_cur = t;
+	}
+	memcpy(E.screen_cur, E.screen_next, sizeof(unsigned long) * E.screen_lines);
 	abFree(&ab);
 }
 
@@ -920,76 +4132,141 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) { 				//displays
 }
 
 void editorMoveCursor(int key) {
-	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	editorBuffer *b = E.buf;
+	if (b->hex) {
+		editorHexMove(key);
+		return;
+	}
+	erow *row = (b->cy >= b->numrows) ? NULL : &b->row[b->cy];
 
 	switch(key) {
 		case ARROW_LEFT:
-			if(E.cx != 0)
-				E.cx--;
-			else if (E.cy > 0){
-				E.cy--;
-				E.cx = E.row[E.cy].size; 	//move left at start of line
+			if(b->cx != 0) {
+				editorRowEnsureCache(b, row); 		//chars of an evicted row come back
+				b->cx = editorRowPrevChar(row, b->cx); 	//a whole character, not a byte
+			}
+			else if (b->cy > 0){
+				b->cy--;
+				b->cx = b->row[b->cy].size; 	//move left at start of line
 			}
 			break;
 		case ARROW_RIGHT:
-			if (row && E.cx < row->size)
-				E.cx++;
-			else if (row && E.cx == row->size) { 	//snap right at end of line
-				E.cy++;
-				E.cx = 0;
+			if (row && b->cx < row->size) {
+				editorRowEnsureCache(b, row);
+				b->cx = editorRowNextChar(row, b->cx);
+			}
+			else if (row && b->cx == row->size) { 	//snap right at end of line
+				b->cy++;
+				b->cx = 0;
 			}
 			break;
 		case ARROW_UP:
-			if (E.cy != 0)
-				E.cy--;
+			if (b->cy != 0)
+				b->cy--;
 			break;
 		case ARROW_DOWN:
-			if (E.cy < E.numrows)
-				E.cy++;
+			if (b->cy < b->numrows)
+				b->cy++;
 			break;
 	}
 
-	row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy]; //we set this variable again because it could have changed during execution
+	row = (b->cy >= b->numrows) ? NULL : &b->row[b->cy]; //we set this variable again because it could have changed during execution
 	int rowlen = row ? row->size : 0;
-	if (E.cx > rowlen) {
-		E.cx = rowlen;
+	if ((key == ARROW_UP || key == ARROW_DOWN) && row) { 	//keep the display column, not the byte index
+		editorRowEnsureCache(b, row);
+		b->cx = editorRowRxtoCx(row, b->rx);
+	}
+	if (b->cx > rowlen) {
+		b->cx = rowlen;
 	}
 }
 void editorProcessKeypress() {
+	editorBuffer *b = E.buf;
 	static int quit_times = KILO_QUIT_TIMES;
+	static int close_confirm = 0;
 	int c = editorReadKey();
+	editorFilterSyncAll(); 				//views must not point at text freed since the last frame
 
 	switch(c) {
 		case '\r':
-			editorInsertNewLine();
+			if (b->source) editorFilterJump(); 	//a filter view can't be edited, Enter goes to the line instead
+			else editorInsertNewLine();
 			break;
 		case CTRL_KEY('q'):
-			if (E.dirty && quit_times > 0) {
+			if (editorAnyDirty() && quit_times > 0) {
 				editorSetStatusMessage("WARNING! File has UNSAVED changes. "
 						"Press Ctrl-Q %d more times to quit.",quit_times);
 				quit_times--;
 				return;
 			}
-			write(STDOUT_FILENO, "\x1b[2J",4); 	//clear the entire screen
-			write(STDOUT_FILENO, "\x1b[H", 3); 	//move the cursor to the 1st row & 1st column
+			editorReapSaves(1); 			//don't quit half-way through a compressed save
+			editorOutputQueue("\x1b[2J", 4, 0); 	//clear the entire screen
+			editorOutputQueue("\x1b[H", 3, 0); 	//move the cursor to the 1st row & 1st column
+			editorOutputFlush(); 			//before the terminal is put back
 			exit(0);
 			break;
 
 		case CTRL_KEY('s'):
 			editorSave();
 			break;
+		//buffers
+		case CTRL_KEY('o'):
+			editorOpenBuffer();
+			break;
+		case CTRL_KEY('n'):
+			editorSwitchBuffer((E.curbuf + 1) % E.numbufs);
+			break;
+		case CTRL_KEY('p'):
+			editorSwitchBuffer((E.curbuf + E.numbufs - 1) % E.numbufs);
+			break;
+		case CTRL_KEY('t'):
+			editorFollow(b, !b->follow);
+			if (b->follow) editorSetStatusMessage("Following %s (Ctrl-T to stop)", b->filename);
+			break;
+		case CTRL_KEY('w'):
+			if (b->dirty && !close_confirm) {
+				editorSetStatusMessage("WARNING! Buffer has UNSAVED changes. "
+						"Press Ctrl-W again to close it.");
+				close_confirm = 1;
+				return;
+			}
+			editorCloseBuffer();
+			break;
 		//cursor movement
 		case HOME_KEY:
-			E.cx = 0;
+			if (b->hex) editorHexMove(c);
+			b->cx = 0;
 			break;
 		case END_KEY:
-			if (E.cy < E.numrows)
-				E.cx = E.row[E.cy].size;
+			if (b->hex) editorHexMove(c);
+			else if (b->cy < b->numrows)
+				b->cx = b->row[b->cy].size;
 			break;
 		//
 		case CTRL_KEY('f'):
 			editorFind();
 			break;
+		case CTRL_KEY('e'):
+			editorToggleWrap();
+			break;
+		case CTRL_KEY('g'):
+			editorGoto();
+			break;
+		case CTRL_KEY('r'):
+			editorReplace();
+			break;
+		case CTRL_KEY('k'):
+			editorFilter();
+			break;
+		case CTRL_KEY('b'):
+			editorToggleHex();
+			break;
+		case CTRL_KEY('z'):
+			editorUndo();
+			break;
+		case CTRL_KEY('y'):
+			editorOutputStats();
+			break;
 		//
 		case BACKSPACE:
 		case CTRL_KEY('h'):
@@ -1001,16 +4278,27 @@ void editorProcessKeypress() {
 		//
 		case PAGE_UP:
 		case PAGE_DOWN:
-			{
+			if (b->hex) {
+				editorHexMove(c);
+				break;
+			}
+			if (b->wrap) {
+				editorWrapPage(c);
+				break;
+			}
+			{ 					//a screen from the edge of the screen, straight there instead of a row at a time
 				if (c == PAGE_UP) {
-					E.cy = E.row_off;
+					b->cy = b->row_off - E.screenrows;
+					if (b->cy < 0) b->cy = 0;
 				} else if (c == PAGE_DOWN) {
-					E.cy = E.row_off + E.screenrows - 1;
-					if (E.cy > E.numrows) E.cy = E.numrows;
+					b->cy = b->row_off + 2 * E.screenrows - 1;
+					if (b->cy > b->numrows) b->cy = b->numrows;
+				}
+				b->cx = 0;
+				if (b->cy < b->numrows) { 		//keep the display column, like the arrows
+					editorRowEnsureCache(b, &b->row[b->cy]);
+					b->cx = editorRowRxtoCx(&b->row[b->cy], b->rx);
 				}
-				int times = E.screenrows;
-				while (times--)
-					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
 			}
 			break;
 		//
@@ -1021,7 +4309,9 @@ void editorProcessKeypress() {
 			editorMoveCursor(c);
 			break;
 		//
-		case CTRL_KEY('l'):
+		case CTRL_KEY('l'): 				//redraw every line, in case something else wrote to the terminal
+			editorScreenReset();
+			break;
 		case '\x1b':
 			break;
 		//
@@ -1030,36 +4320,60 @@ void editorProcessKeypress() {
 			break;
 	}
 	quit_times = KILO_QUIT_TIMES; 	//resets the amount of quit_times when a user does anything but press ctrl-q
+	close_confirm = 0;
 }
 
 /*** init ***/
 void initEditor() {
-	E.cx = 0; 	//init cursor x position
-	E.cy = 0; 	//init cursor y position
-	E.rx = 0; 	//init render marker
-	E.row_off = 0; 	//init row offset
-	E.col_off = 0; 	//init column offset
-	E.numrows = 0; 	//init number of rows
-	E.row = NULL; 	//init the array of rows. 
-	E.dirty = 0; 	//the file is clean before we edit
+	E.bufs = NULL; 	//init the array of buffers
+	E.numbufs = 0; 	//no buffers are open yet
+	E.tick = 0;
+	E.inotify_fd = -1; 	//created on the first follow
+	E.saves = NULL;
+	pthread_mutex_init(&E.save_lock, NULL);
+	if (pipe2(E.wake_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		die("pipe");
+	editorPoolInit(); 	//threads for highlighting whole files
+	editorOutputInit(); 	//the thread that writes to the terminal
+	E.syntaxes = NULL;
+	E.numsyntaxes = 0;
+	editorLoadSyntaxes(); 	//before any file is opened & matched against them
 	E.screenrows -= 1; //to make room for the status bar
-	E.filename = NULL; //init filename
 	E.statusmsg[0] = '\0';
 	E.statusmsg_time = 0;
 	if (getWindowSize(&E.screenrows, &E.screencols) == -1)
 		die("getWindowSize");
 	E.screenrows-=2;
-	E.syntax = NULL;
+	editorScreenReset();
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = editorHandleWinch;
+	sa.sa_flags = SA_RESTART; 		//a read() it interrupts carries on, poll() still returns so we look at it
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGWINCH, &sa, NULL);
 }
 
 int main(int argc, char* argv[]) {
 	enableRawMode();
 	initEditor();
-	if (argc > 1) {
-		editorOpen(argv[1]);
+	int follow = 0;
+	for (int j = 1; j < argc; j++) { 			//each file gets its own buffer
+		if (!strcmp(argv[j], "-f")) { 			//-f, follow the files after it
+			follow = 1;
+			continue;
+		}
+		editorBuffer *b = editorNewBuffer();
+		if (editorOpen(b, argv[j]) == -1)
+			die("fopen");
+		if (follow) editorFollow(b, 1);
+	}
+	if (E.numbufs == 0) {
+		editorNewBuffer(); 				//an empty [No Name] buffer
 	}
-	editorSetStatusMessage("HELP: Ctrl-S = SAVE | Ctrl-Q = QUIT | Ctrl-F = FIND");
+	editorSwitchBuffer(0);
+	editorSetStatusMessage("HELP: ^S save | ^Q quit | ^F find | ^O open | ^N/^P/^W bufs | ^T follow | ^E wrap | ^G go to | ^R replace | ^K filter | ^B hex | ^Z undo");
 	while (1) {
+		editorProcessEvents();
 		editorRefreshScreen();
 		editorProcessKeypress();
 	}